@@ -0,0 +1,497 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "../src/GD.h"
+#include "../src/Velux.h"
+#include "../src/VeluxCentral.h"
+#include "../src/VeluxPeer.h"
+#include "../src/PhysicalInterfaces/Klf200.h"
+#include "../src/PhysicalInterfaces/LoopbackTransport.h"
+#include "../src/PhysicalInterfaces/Slip.h"
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <thread>
+
+namespace
+{
+std::atomic<uint64_t> allocationCount{0};
+}
+
+//{{{ Count allocations. The array and nothrow versions call these.
+void* operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if(!memory) throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+//}}}
+
+namespace Velux
+{
+
+/**
+ * Makes the protected decoding and encoding of VeluxPeer accessible. The peer is set up from the device description
+ * only, so nothing is read from or written to a database.
+ */
+class BenchmarkPeer : public VeluxPeer
+{
+public:
+    using VeluxPeer::DecodedValue;
+
+    BenchmarkPeer(int32_t id, int32_t address, const std::string& serialNumber, uint32_t deviceType, const PHomegearDevice& rpcDevice) : VeluxPeer(id, address, serialNumber, 1, nullptr)
+    {
+        _deviceType = deviceType;
+        _rpcDevice = rpcDevice;
+        for(auto& function : _rpcDevice->functions)
+        {
+            if(!function.second->variables) continue;
+            for(auto& parameter : function.second->variables->parameters)
+            {
+                auto& rpcConfigurationParameter = valuesCentral[function.first][parameter.first];
+                rpcConfigurationParameter.rpcParameter = parameter.second;
+                std::vector<uint8_t> data;
+                parameter.second->convertToPacket(parameter.second->logical->getDefaultValue(), rpcConfigurationParameter.mainRole(), data);
+                rpcConfigurationParameter.setBinaryData(data);
+            }
+        }
+        compilePacketPlans();
+    }
+
+    void decode(const PVeluxPacket& packet, std::vector<DecodedValue>& decodedValues)
+    {
+        decodePacket(packet, decodedValues);
+    }
+
+    std::vector<std::string> getEncoderIds()
+    {
+        std::vector<std::string> ids;
+        for(auto& encoder : _frameEncoders)
+        {
+            ids.push_back(encoder.first);
+        }
+        return ids;
+    }
+
+    /**
+     * Builds the frame "encoderId" with the current value of the parameter it was compiled for. This is what setValue()
+     * does before the packet is sent.
+     */
+    PVeluxPacket encode(const std::string& encoderId)
+    {
+        auto& encoder = _frameEncoders.at(encoderId);
+        auto& parameter = valuesCentral.at(encoder.channel).at(encoder.parameterId);
+        return encodePacket(encoder, encoder.channel, parameter.rpcParameter, parameter.getBinaryData());
+    }
+};
+
+class BenchmarkCentral : public VeluxCentral
+{
+public:
+    BenchmarkCentral() : VeluxCentral(0, "VLX0000001", 1, nullptr) {}
+
+    void addPeer(const std::shared_ptr<VeluxPeer>& peer, const std::string& interfaceId)
+    {
+        std::lock_guard<std::mutex> peersGuard(_peersMutex);
+        _peersById[peer->getID()] = peer;
+        _peersBySerial[peer->getSerialNumber()] = peer;
+        setNodePeer(interfaceId, peer->getAddress(), peer);
+    }
+
+    void publish()
+    {
+        std::lock_guard<std::mutex> peersGuard(_peersMutex);
+        publishPeers();
+    }
+};
+
+}
+
+namespace
+{
+
+/**
+ * Prevents the compiler from optimizing away the computation of "value".
+ */
+template<typename T>
+inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * Runs "function" "iterations" times after a warm up and prints the time per call, the calls per second (e.g. frames
+ * built per second for the encodePacket benchmarks) and the number of allocations per call.
+ */
+template<typename Function>
+void measure(const std::string& name, int64_t iterations, Function&& function)
+{
+    for(int64_t i = 0; i < iterations / 10 + 1; i++)
+    {
+        function();
+    }
+
+    uint64_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+    auto startTime = std::chrono::steady_clock::now();
+    for(int64_t i = 0; i < iterations; i++)
+    {
+        function();
+    }
+    int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+    uint64_t allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+
+    std::cout << std::left << std::setw(48) << name << std::right << std::fixed
+              << std::setw(12) << std::setprecision(1) << ((double)duration / iterations) << " ns/op"
+              << std::setw(14) << std::setprecision(0) << ((double)iterations * 1000000000.0 / std::max(duration, (int64_t)1)) << " op/s"
+              << std::setw(10) << std::setprecision(2) << ((double)allocations / iterations) << " allocs/op" << std::endl;
+}
+
+/**
+ * Minimal gateway on the other end of a loopback pair. Answers every request with its confirmation, so Klf200 can run
+ * its initialization and request flows without a socket or TLS.
+ */
+class LoopbackGateway
+{
+public:
+    explicit LoopbackGateway(std::shared_ptr<Velux::LoopbackTransport> transport) : _transport(std::move(transport))
+    {
+        _thread = std::thread(&LoopbackGateway::run, this);
+    }
+
+    ~LoopbackGateway()
+    {
+        _stop = true;
+        if(_thread.joinable()) _thread.join();
+    }
+
+    uint64_t getRequestCount() { return _requestCount; }
+private:
+    std::shared_ptr<Velux::LoopbackTransport> _transport;
+    std::atomic_bool _stop{false};
+    std::atomic<uint64_t> _requestCount{0};
+    std::thread _thread;
+
+    static std::vector<uint8_t> getConfirmationPayload(Velux::VeluxCommand requestCommand)
+    {
+        switch(requestCommand)
+        {
+            //Success
+            case Velux::VeluxCommand::GW_PASSWORD_ENTER_REQ: return std::vector<uint8_t>{0};
+            //Software version 0.2.0.0.71.0, hardware version 6, product group 14, product type 3 (KLF200)
+            case Velux::VeluxCommand::GW_GET_VERSION_REQ: return std::vector<uint8_t>{0, 2, 0, 0, 71, 0, 6, 14, 3};
+            case Velux::VeluxCommand::GW_GET_PROTOCOL_VERSION_REQ: return std::vector<uint8_t>{0, 3, 0, 18};
+            //Gateway mode with actuator nodes, idle
+            case Velux::VeluxCommand::GW_GET_STATE_REQ: return std::vector<uint8_t>{2, 0, 0, 0, 0, 0};
+            default: return std::vector<uint8_t>();
+        }
+    }
+
+    void run()
+    {
+        std::vector<uint8_t> buffer(1024);
+        Velux::Slip slip;
+        while(!_stop)
+        {
+            size_t bytesRead = 0;
+            try
+            {
+                bytesRead = _transport->read(buffer.data(), buffer.size());
+            }
+            catch(const C1Net::TimeoutException& ex)
+            {
+                continue;
+            }
+            catch(const C1Net::ClosedException& ex)
+            {
+                //Wait for Klf200 to reopen the connection or for the benchmark to end.
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+
+            slip.decode(buffer.data(), bytesRead, [&](std::vector<uint8_t>& frame)
+            {
+                auto request = std::make_shared<Velux::VeluxPacket>(frame);
+                auto confirmation = std::make_shared<Velux::VeluxPacket>(request->getResponseCommand(), getConfirmationPayload(request->getCommand()));
+                try
+                {
+                    _transport->send(Velux::Slip::encode(confirmation->getBinary()));
+                    _requestCount++;
+                }
+                catch(const C1Net::ClosedException& ex)
+                {
+                }
+            });
+        }
+    }
+};
+
+std::vector<uint8_t> createFrame(Velux::VeluxCommand command, const std::vector<uint8_t>& payload)
+{
+    return std::make_shared<Velux::VeluxPacket>(command, payload)->getBinary();
+}
+
+//GW_NODE_STATE_POSITION_CHANGED_NTF of node 5 moving from 40 % to 60 %. The remaining time contains 0xC0 and 0xDB, so
+//SLIP has to escape two bytes.
+const std::vector<uint8_t> positionChangedPayload{0x05, 0x04, 0x50, 0x00, 0x78, 0x00, 0xF7, 0xFF, 0xF7, 0xFF, 0xF7, 0xFF, 0xF7, 0xFF, 0xC0, 0xDB, 0x5C, 0x8F, 0x12, 0x34};
+
+void printHelp()
+{
+    std::cout << "Usage: klf200-benchmark [OPTIONS]" << std::endl << std::endl;
+    std::cout << "Measures the hot paths of the Velux KLF200 module in ns/op, op/s and allocations/op." << std::endl << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  -i, --iterations COUNT       Iterations per benchmark (default: 1000000)" << std::endl;
+    std::cout << "  -d, --devices DIRECTORY      Directory containing the device description files" << std::endl;
+    std::cout << "                               (default: \"misc/Device Description Files\")" << std::endl;
+    std::cout << "  -p, --peers COUNT            Number of peers used for the lookup benchmarks (default: 200)" << std::endl;
+    std::cout << "  -h, --help                   Show this help" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        int64_t iterations = 1000000;
+        std::string deviceDescriptionPath = "misc/Device Description Files";
+        int32_t peerCount = 200;
+
+        static struct option longOptions[] =
+        {
+            {"iterations", required_argument, nullptr, 'i'},
+            {"devices", required_argument, nullptr, 'd'},
+            {"peers", required_argument, nullptr, 'p'},
+            {"help", no_argument, nullptr, 'h'},
+            {nullptr, 0, nullptr, 0}
+        };
+
+        int32_t option = 0;
+        while((option = getopt_long(argc, argv, "i:d:p:h", longOptions, nullptr)) != -1)
+        {
+            switch(option)
+            {
+                case 'i': iterations = std::stoll(optarg); break;
+                case 'd': deviceDescriptionPath = optarg; break;
+                case 'p': peerCount = std::stoi(optarg); break;
+                case 'h': printHelp(); return 0;
+                default: printHelp(); return 1;
+            }
+        }
+        if(iterations < 1 || peerCount < 1)
+        {
+            printHelp();
+            return 1;
+        }
+        if(deviceDescriptionPath.back() != '/') deviceDescriptionPath.push_back('/');
+
+        BaseLib::SharedObjects bl;
+        bl.debugLevel = 2;
+        Velux::Velux family(&bl, nullptr);
+
+        bool oldFormat = false;
+        auto rollerShutter = std::make_shared<BaseLib::DeviceDescription::HomegearDevice>(&bl, deviceDescriptionPath + "0080-Roller-Shutter.xml", oldFormat);
+        auto window = std::make_shared<BaseLib::DeviceDescription::HomegearDevice>(&bl, deviceDescriptionPath + "010X-Window.xml", oldFormat);
+        if(!rollerShutter->loaded() || !window->loaded())
+        {
+            std::cerr << "Error: Could not load the device description files from \"" << deviceDescriptionPath << "\"." << std::endl;
+            return 1;
+        }
+
+        auto rollerShutterPeer = std::make_shared<Velux::BenchmarkPeer>(1, 5, "BENCH0000001", 0x0080, rollerShutter);
+        auto windowPeer = std::make_shared<Velux::BenchmarkPeer>(2, 5, "BENCH0000002", 0x0101, window);
+
+        std::cout << iterations << " iterations per benchmark" << std::endl << std::endl;
+
+        //{{{ Framing
+        {
+            auto frame = createFrame(Velux::VeluxCommand::GW_NODE_STATE_POSITION_CHANGED_NTF, positionChangedPayload);
+            auto slipFrame = Velux::Slip::encode(frame);
+
+            measure("Slip::encode", iterations, [&]()
+            {
+                doNotOptimize(Velux::Slip::encode(frame).size());
+            });
+
+            Velux::Slip slip;
+            measure("Slip::decode", iterations, [&]()
+            {
+                slip.decode(slipFrame.data(), slipFrame.size(), [](std::vector<uint8_t>& decodedFrame) { doNotOptimize(decodedFrame.size()); });
+            });
+
+            measure("VeluxPacket(binary) incl. checksum", iterations, [&]()
+            {
+                doNotOptimize(std::make_shared<Velux::VeluxPacket>(frame)->getPayload().size());
+            });
+
+            auto packet = std::make_shared<Velux::VeluxPacket>(frame);
+            measure("VeluxPacket::getBinary (cached)", iterations, [&]()
+            {
+                doNotOptimize(packet->getBinary().size());
+            });
+
+            measure("VeluxPacket(command, payload) + getBinary", iterations, [&]()
+            {
+                doNotOptimize(std::make_shared<Velux::VeluxPacket>(Velux::VeluxCommand::GW_NODE_STATE_POSITION_CHANGED_NTF, positionChangedPayload)->getBinary().size());
+            });
+        }
+        //}}}
+
+        //{{{ Decoding and encoding
+        {
+            auto packet = std::make_shared<Velux::VeluxPacket>(createFrame(Velux::VeluxCommand::GW_NODE_STATE_POSITION_CHANGED_NTF, positionChangedPayload));
+            std::vector<Velux::BenchmarkPeer::DecodedValue> decodedValues;
+            decodedValues.reserve(16);
+            for(auto& peer : {std::make_pair(std::string("roller shutter"), rollerShutterPeer), std::make_pair(std::string("window"), windowPeer)})
+            {
+                measure("decodePacket 0x0211 (" + peer.first + ")", iterations, [&]()
+                {
+                    decodedValues.clear();
+                    peer.second->decode(packet, decodedValues);
+                    doNotOptimize(decodedValues.size());
+                });
+
+                for(auto& encoderId : peer.second->getEncoderIds())
+                {
+                    measure("encodePacket " + encoderId, iterations, [&]()
+                    {
+                        auto encodedPacket = peer.second->encode(encoderId);
+                        if(encodedPacket) doNotOptimize(encodedPacket->getBinary().size());
+                    });
+                }
+            }
+        }
+        //}}}
+
+        //{{{ Request engine over loopback
+        {
+            //Runs Klf200 without socket and TLS. Compared with the round trip to a real gateway, this shows how much of
+            //the latency is spent in the module itself.
+            auto transports = Velux::LoopbackTransport::createPair(100);
+            LoopbackGateway gateway(transports.second);
+
+            auto settings = std::make_shared<BaseLib::Systems::PhysicalInterfaceSettings>();
+            settings->id = "Loopback";
+            settings->type = "klf200";
+            settings->password = "Benchmark";
+            auto interface = std::make_shared<Velux::Klf200>(settings);
+            interface->setTransport(transports.first);
+
+            //GW_PASSWORD_ENTER, GW_GET_VERSION, GW_GET_PROTOCOL_VERSION, GW_HOUSE_STATUS_MONITOR_ENABLE, GW_SET_UTC and
+            //GW_GET_STATE
+            const uint64_t initRequestCount = 6;
+            auto startTime = std::chrono::steady_clock::now();
+            interface->startListening();
+            while(gateway.getRequestCount() < initRequestCount && std::chrono::steady_clock::now() - startTime < std::chrono::seconds(10))
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            if(gateway.getRequestCount() < initRequestCount)
+            {
+                std::cerr << "Error: Initialization over loopback did not finish." << std::endl;
+                interface->stopListening();
+                return 1;
+            }
+            int64_t initDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+            std::cout << std::left << std::setw(48) << "Klf200 initialization (loopback)" << std::right << std::setw(12) << initDuration << " us" << std::endl;
+
+            //Every round trip passes the reactor and the writer pool, so fewer iterations are needed.
+            auto request = std::make_shared<Velux::VeluxPacket>(Velux::VeluxCommand::GW_GET_STATE_REQ, std::vector<uint8_t>());
+            measure("Klf200::sendRequest GW_GET_STATE (loopback)", std::max(iterations / 100, (int64_t)100), [&]()
+            {
+                doNotOptimize((bool)interface->sendRequest(request));
+            });
+
+            interface->stopListening();
+        }
+        //}}}
+
+        //{{{ Peer lookups
+        {
+            auto central = std::make_shared<Velux::BenchmarkCentral>();
+            std::vector<std::string> serialNumbers;
+            serialNumbers.reserve(peerCount);
+            for(int32_t i = 0; i < peerCount; i++)
+            {
+                std::ostringstream serialNumber;
+                serialNumber << "BENCH" << std::setw(7) << std::setfill('0') << (i + 1);
+                serialNumbers.push_back(serialNumber.str());
+                auto peer = std::make_shared<Velux::BenchmarkPeer>(i + 1, i % 200, serialNumbers.back(), i % 2 == 0 ? 0x0080 : 0x0101, i % 2 == 0 ? rollerShutter : window);
+                central->addPeer(peer, "KLF200-" + std::to_string(i / 200));
+            }
+            central->publish();
+
+            uint64_t index = 0;
+            measure("VeluxCentral::getPeer(id)", iterations, [&]()
+            {
+                doNotOptimize((bool)central->getPeer((uint64_t)(index++ % peerCount) + 1));
+            });
+
+            measure("VeluxCentral::getPeer(serialNumber)", iterations, [&]()
+            {
+                doNotOptimize((bool)central->getPeer(serialNumbers[index++ % peerCount]));
+            });
+
+            std::string interfaceId = "KLF200-0";
+            measure("VeluxCentral::getPeer(interfaceId, nodeId)", iterations, [&]()
+            {
+                doNotOptimize((bool)central->getPeer(interfaceId, index++ % std::min(peerCount, 200)));
+            });
+
+            central->dispose();
+        }
+        //}}}
+
+        family.dispose();
+        return 0;
+    }
+    catch(const std::exception& ex)
+    {
+        std::cerr << "Error: " << ex.what() << std::endl;
+    }
+    return 1;
+}
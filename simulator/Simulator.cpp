@@ -0,0 +1,538 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "Simulator.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+namespace Velux {
+
+namespace {
+//Commands used by the simulator. See VeluxCommand in VeluxPacket.h for the full list.
+constexpr uint16_t GW_ERROR_NTF = 0x0000;
+constexpr uint16_t GW_REBOOT_REQ = 0x0001;
+constexpr uint16_t GW_GET_VERSION_REQ = 0x0008;
+constexpr uint16_t GW_GET_PROTOCOL_VERSION_REQ = 0x000A;
+constexpr uint16_t GW_GET_STATE_REQ = 0x000C;
+constexpr uint16_t GW_GET_NODE_INFORMATION_REQ = 0x0200;
+constexpr uint16_t GW_GET_NODE_INFORMATION_NTF = 0x0210;
+constexpr uint16_t GW_GET_ALL_NODES_INFORMATION_REQ = 0x0202;
+constexpr uint16_t GW_GET_ALL_NODES_INFORMATION_NTF = 0x0204;
+constexpr uint16_t GW_GET_ALL_NODES_INFORMATION_FINISHED_NTF = 0x0205;
+constexpr uint16_t GW_NODE_STATE_POSITION_CHANGED_NTF = 0x0211;
+constexpr uint16_t GW_HOUSE_STATUS_MONITOR_ENABLE_REQ = 0x0240;
+constexpr uint16_t GW_HOUSE_STATUS_MONITOR_DISABLE_REQ = 0x0242;
+constexpr uint16_t GW_COMMAND_SEND_REQ = 0x0300;
+constexpr uint16_t GW_COMMAND_RUN_STATUS_NTF = 0x0302;
+constexpr uint16_t GW_SESSION_FINISHED_NTF = 0x0304;
+constexpr uint16_t GW_GET_SCENE_LIST_REQ = 0x040C;
+constexpr uint16_t GW_GET_SCENE_LIST_NTF = 0x040E;
+constexpr uint16_t GW_ACTIVATE_SCENE_REQ = 0x0412;
+constexpr uint16_t GW_STOP_SCENE_REQ = 0x0415;
+constexpr uint16_t GW_SET_UTC_REQ = 0x2000;
+constexpr uint16_t GW_PASSWORD_ENTER_REQ = 0x3000;
+
+//Error numbers of GW_ERROR_NTF
+constexpr uint8_t errorCommandUnknown = 1;
+constexpr uint8_t errorFrameStructure = 2;
+constexpr uint8_t errorBusy = 7;
+constexpr uint8_t errorNotAuthenticated = 12;
+
+constexpr uint16_t positionMax = 0xC800;
+constexpr uint16_t positionStop = 0xD200;
+
+constexpr uint8_t stateExecuting = 4;
+constexpr uint8_t stateDone = 5;
+
+constexpr uint8_t runStatusCompleted = 0;
+constexpr uint8_t runStatusFailed = 1;
+constexpr uint8_t runStatusActive = 2;
+}
+
+Simulator::Simulator(const Settings &settings) : _settings(settings), _random(settings.seed) {
+  _settings.nodeCount = std::max(0, std::min(_settings.nodeCount, 200));
+  _settings.sceneCount = std::max(0, std::min(_settings.sceneCount, 100));
+  if (_settings.travelTime < 1) _settings.travelTime = 1;
+  if (_settings.notificationInterval < 1) _settings.notificationInterval = 1;
+  createNodes();
+  createScenes();
+}
+
+Simulator::~Simulator() {
+  closeClient();
+  if (_serverSocket != -1) ::close(_serverSocket);
+}
+
+int64_t Simulator::getTime() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Simulator::createNodes() {
+  std::uniform_int_distribution<uint32_t> positionDistribution(0, positionMax);
+  for (int32_t i = 0; i < _settings.nodeCount; i++) {
+    Node node;
+    node.id = (uint8_t)i;
+    //Alternate between roller shutters (0x0080) and window openers (0x0101)
+    node.type = (i % 2 == 0) ? 0x0080 : 0x0101;
+    node.name = std::string(node.type == 0x0080 ? "Roller shutter " : "Window ") + std::to_string(i);
+    node.serialNumber[0] = 'S';
+    node.serialNumber[1] = 'I';
+    node.serialNumber[2] = 'M';
+    //Include the port, so multiple simulators don't create equal serial numbers.
+    node.serialNumber[3] = _settings.port >> 8;
+    node.serialNumber[4] = _settings.port & 0xFF;
+    node.serialNumber[7] = node.id;
+    node.position = (uint16_t)(positionDistribution(_random) / 512 * 512);
+    node.target = node.position;
+    _nodes.emplace(node.id, node);
+  }
+}
+
+void Simulator::createScenes() {
+  if (_nodes.empty()) return;
+  std::uniform_int_distribution<uint32_t> positionDistribution(0, 4);
+  std::bernoulli_distribution nodeDistribution(0.5);
+  for (int32_t i = 0; i < _settings.sceneCount; i++) {
+    Scene scene;
+    scene.id = (uint8_t)i;
+    scene.name = "Scene " + std::to_string(i);
+    for (auto &node: _nodes) {
+      if (nodeDistribution(_random)) scene.positions.emplace_back(node.first, (uint16_t)(positionDistribution(_random) * positionMax / 4));
+    }
+    if (scene.positions.empty()) scene.positions.emplace_back(_nodes.begin()->first, 0);
+    _scenes.push_back(std::move(scene));
+  }
+}
+
+int32_t Simulator::run() {
+  if (!listen()) return 1;
+  std::cout << "Listening on " << _settings.bindAddress << ":" << _settings.port << " with " << _nodes.size() << " nodes and " << _scenes.size() << " scenes." << std::endl;
+
+  while (!_stop) {
+    pollfd pollInfo{_serverSocket, POLLIN, 0};
+    int32_t result = poll(&pollInfo, 1, 100);
+    if (result <= 0) continue;
+
+    sockaddr_in clientAddress{};
+    socklen_t clientAddressSize = sizeof(clientAddress);
+    _clientSocket = accept(_serverSocket, (sockaddr *)&clientAddress, &clientAddressSize);
+    if (_clientSocket == -1) continue;
+    int32_t noDelay = 1;
+    setsockopt(_clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    char ipString[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &clientAddress.sin_addr, ipString, sizeof(ipString));
+    std::cout << "Client " << ipString << " connected." << std::endl;
+    serveClient();
+    std::cout << "Client " << ipString << " disconnected." << std::endl;
+  }
+  return 0;
+}
+
+bool Simulator::listen() {
+  _serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+  if (_serverSocket == -1) {
+    std::cerr << "Error: Could not create socket: " << strerror(errno) << std::endl;
+    return false;
+  }
+  int32_t reuseAddress = 1;
+  setsockopt(_serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(_settings.port);
+  if (inet_pton(AF_INET, _settings.bindAddress.c_str(), &address.sin_addr) != 1) {
+    std::cerr << "Error: Invalid bind address " << _settings.bindAddress << std::endl;
+    return false;
+  }
+  if (bind(_serverSocket, (sockaddr *)&address, sizeof(address)) == -1 || ::listen(_serverSocket, 1) == -1) {
+    std::cerr << "Error: Could not listen on port " << _settings.port << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void Simulator::closeClient() {
+  if (_clientSocket != -1) ::close(_clientSocket);
+  _clientSocket = -1;
+  _authenticated = false;
+  _slip.reset();
+  _outgoingFrames = decltype(_outgoingFrames)();
+  _sessions.clear();
+  for (auto &node: _nodes) {
+    node.second.moving = false;
+    node.second.target = node.second.position;
+    node.second.state = stateDone;
+  }
+}
+
+void Simulator::serveClient() {
+  std::vector<uint8_t> buffer(1024);
+  while (!_stop) {
+    int64_t timeout = _settings.notificationInterval;
+    if (!_outgoingFrames.empty()) timeout = std::min(timeout, std::max((int64_t)0, _outgoingFrames.top().time - getTime()));
+
+    pollfd pollInfo{_clientSocket, POLLIN, 0};
+    int32_t result = poll(&pollInfo, 1, (int32_t)timeout);
+    if (result < 0 && errno != EINTR) break;
+    if (result > 0) {
+      if (pollInfo.revents & (POLLERR | POLLHUP | POLLNVAL)) break;
+      ssize_t bytesRead = recv(_clientSocket, buffer.data(), buffer.size(), 0);
+      if (bytesRead <= 0) break;
+      _slip.decode(buffer.data(), (size_t)bytesRead, [&](std::vector<uint8_t> &frame) { processFrame(frame); });
+    }
+
+    updateNodes();
+    sendDueFrames();
+    if (_clientSocket == -1) return;
+  }
+  closeClient();
+}
+
+void Simulator::queueFrame(uint16_t command, const std::vector<uint8_t> &payload, int64_t delay) {
+  ScheduledFrame scheduledFrame;
+  scheduledFrame.time = getTime() + delay;
+  scheduledFrame.sequence = _sequence++;
+  scheduledFrame.frame.reserve(payload.size() + 5);
+  scheduledFrame.frame.push_back(0);
+  scheduledFrame.frame.push_back((uint8_t)(payload.size() + 3));
+  scheduledFrame.frame.push_back(command >> 8);
+  scheduledFrame.frame.push_back(command & 0xFF);
+  scheduledFrame.frame.insert(scheduledFrame.frame.end(), payload.begin(), payload.end());
+  uint8_t checksum = 0;
+  for (auto byte: scheduledFrame.frame) {
+    checksum ^= byte;
+  }
+  scheduledFrame.frame.push_back(checksum);
+  _outgoingFrames.push(std::move(scheduledFrame));
+}
+
+void Simulator::sendDueFrames() {
+  int64_t time = getTime();
+  while (!_outgoingFrames.empty() && _outgoingFrames.top().time <= time) {
+    auto slipFrame = Slip::encode(_outgoingFrames.top().frame);
+    _outgoingFrames.pop();
+    size_t bytesSent = 0;
+    while (bytesSent < slipFrame.size()) {
+      ssize_t result = send(_clientSocket, slipFrame.data() + bytesSent, slipFrame.size() - bytesSent, MSG_NOSIGNAL);
+      if (result <= 0) {
+        closeClient();
+        return;
+      }
+      bytesSent += (size_t)result;
+    }
+  }
+}
+
+int64_t Simulator::getResponseDelay() {
+  int64_t delay = _settings.latency;
+  if (_settings.latencyJitter > 0) delay += std::uniform_int_distribution<int32_t>(0, _settings.latencyJitter)(_random);
+  return delay;
+}
+
+void Simulator::processFrame(std::vector<uint8_t> &frame) {
+  if (frame.size() < 5 || frame[0] != 0 || frame[1] != frame.size() - 2) {
+    queueFrame(GW_ERROR_NTF, {errorFrameStructure});
+    return;
+  }
+  uint8_t checksum = 0;
+  for (size_t i = 0; i < frame.size() - 1; i++) {
+    checksum ^= frame[i];
+  }
+  if (checksum != frame.back()) {
+    queueFrame(GW_ERROR_NTF, {errorFrameStructure});
+    return;
+  }
+
+  uint16_t command = (((uint16_t)frame[2]) << 8) | frame[3];
+  std::vector<uint8_t> payload(frame.begin() + 4, frame.end() - 1);
+  if (_settings.verbose) std::cout << "Request 0x" << std::hex << command << std::dec << " (" << payload.size() << " bytes)" << std::endl;
+
+  if (command != GW_PASSWORD_ENTER_REQ) {
+    if (!_authenticated) {
+      queueFrame(GW_ERROR_NTF, {errorNotAuthenticated}, getResponseDelay());
+      return;
+    }
+    if (_settings.dropRate > 0 && std::bernoulli_distribution(_settings.dropRate)(_random)) return;
+    if (_settings.errorRate > 0 && std::bernoulli_distribution(_settings.errorRate)(_random)) {
+      queueFrame(GW_ERROR_NTF, {errorBusy}, getResponseDelay());
+      return;
+    }
+  }
+
+  processRequest(command, payload);
+}
+
+void Simulator::processRequest(uint16_t command, const std::vector<uint8_t> &payload) {
+  int64_t delay = getResponseDelay();
+  //Confirmations always have the command of the request plus one.
+  uint16_t confirmation = command + 1;
+  switch (command) {
+    case GW_PASSWORD_ENTER_REQ: {
+      std::string password;
+      for (auto byte: payload) {
+        if (byte == 0) break;
+        password.push_back((char)byte);
+      }
+      _authenticated = payload.size() == 32 && password == _settings.password;
+      queueFrame(confirmation, {(uint8_t)(_authenticated ? 0 : 1)}, delay);
+      break;
+    }
+    case GW_REBOOT_REQ:
+      queueFrame(confirmation, {}, delay);
+      break;
+    case GW_GET_VERSION_REQ:
+      //Software version 0.2.0.0.71.0, hardware version 6, product group 14, product type 3
+      queueFrame(confirmation, {0, 2, 0, 0, 71, 0, 6, 14, 3}, delay);
+      break;
+    case GW_GET_PROTOCOL_VERSION_REQ:
+      queueFrame(confirmation, {0, 3, 0, 14}, delay);
+      break;
+    case GW_GET_STATE_REQ:
+      //Gateway mode with actuator nodes, idle
+      queueFrame(confirmation, {(uint8_t)(_nodes.empty() ? 1 : 2), 0, 0, 0, 0, 0}, delay);
+      break;
+    case GW_HOUSE_STATUS_MONITOR_ENABLE_REQ:
+    case GW_HOUSE_STATUS_MONITOR_DISABLE_REQ:
+    case GW_SET_UTC_REQ:
+      queueFrame(confirmation, {}, delay);
+      break;
+    case GW_GET_NODE_INFORMATION_REQ: {
+      if (payload.empty()) {
+        queueFrame(GW_ERROR_NTF, {errorFrameStructure}, delay);
+        break;
+      }
+      auto nodeIterator = _nodes.find(payload[0]);
+      queueFrame(confirmation, {(uint8_t)(nodeIterator == _nodes.end() ? 2 : 0), payload[0]}, delay);
+      if (nodeIterator != _nodes.end()) queueFrame(GW_GET_NODE_INFORMATION_NTF, getNodeInformation(nodeIterator->second), delay);
+      break;
+    }
+    case GW_GET_ALL_NODES_INFORMATION_REQ:
+      queueFrame(confirmation, {(uint8_t)(_nodes.empty() ? 1 : 0), (uint8_t)_nodes.size()}, delay);
+      for (auto &node: _nodes) {
+        queueFrame(GW_GET_ALL_NODES_INFORMATION_NTF, getNodeInformation(node.second), delay);
+      }
+      queueFrame(GW_GET_ALL_NODES_INFORMATION_FINISHED_NTF, {}, delay);
+      break;
+    case GW_COMMAND_SEND_REQ: {
+      if (payload.size() < 66) {
+        queueFrame(GW_ERROR_NTF, {errorFrameStructure}, delay);
+        break;
+      }
+      uint16_t sessionId = (((uint16_t)payload[0]) << 8) | payload[1];
+      uint16_t mainParameter = (((uint16_t)payload[7]) << 8) | payload[8];
+      uint8_t indexArrayCount = std::min(payload[41], (uint8_t)20);
+      queueFrame(confirmation, {payload[0], payload[1], 1}, delay);
+
+      for (uint8_t i = 0; i < indexArrayCount; i++) {
+        auto nodeIterator = _nodes.find(payload[42 + i]);
+        if (nodeIterator == _nodes.end()) {
+          queueFrame(GW_COMMAND_RUN_STATUS_NTF, {payload[0], payload[1], 1, payload[42 + i], 0, 0, 0, runStatusFailed, 2, 0, 0, 0, 0}, delay);
+          continue;
+        }
+        if (mainParameter == positionStop) stopNode(nodeIterator->second, delay);
+        else if (mainParameter <= positionMax) moveNode(nodeIterator->second, sessionId, mainParameter, delay);
+        else queueFrame(GW_COMMAND_RUN_STATUS_NTF, {payload[0], payload[1], 1, payload[42 + i], 0, 0, 0, runStatusFailed, 1, 0, 0, 0, 0}, delay);
+      }
+      if (_sessions.find(sessionId) == _sessions.end()) queueFrame(GW_SESSION_FINISHED_NTF, {payload[0], payload[1]}, delay);
+      break;
+    }
+    case GW_GET_SCENE_LIST_REQ: {
+      queueFrame(confirmation, {(uint8_t)_scenes.size()}, delay);
+      //Up to three scenes per notification. The last byte holds the number of remaining scenes.
+      for (size_t i = 0; i < _scenes.size(); i += 3) {
+        size_t count = std::min((size_t)3, _scenes.size() - i);
+        std::vector<uint8_t> notification;
+        notification.reserve(2 + count * 65);
+        notification.push_back((uint8_t)count);
+        for (size_t j = i; j < i + count; j++) {
+          notification.push_back(_scenes[j].id);
+          std::string name = _scenes[j].name;
+          name.resize(64, 0);
+          notification.insert(notification.end(), name.begin(), name.end());
+        }
+        notification.push_back((uint8_t)(_scenes.size() - i - count));
+        queueFrame(GW_GET_SCENE_LIST_NTF, notification, delay);
+      }
+      break;
+    }
+    case GW_ACTIVATE_SCENE_REQ:
+    case GW_STOP_SCENE_REQ: {
+      if (payload.size() < 5) {
+        queueFrame(GW_ERROR_NTF, {errorFrameStructure}, delay);
+        break;
+      }
+      uint16_t sessionId = (((uint16_t)payload[0]) << 8) | payload[1];
+      auto sceneIterator = std::find_if(_scenes.begin(), _scenes.end(), [&](const Scene &scene) { return scene.id == payload[4]; });
+      queueFrame(confirmation, {(uint8_t)(sceneIterator == _scenes.end() ? 1 : 0), payload[0], payload[1]}, delay);
+      if (sceneIterator == _scenes.end()) break;
+      for (auto &position: sceneIterator->positions) {
+        auto nodeIterator = _nodes.find(position.first);
+        if (nodeIterator == _nodes.end()) continue;
+        if (command == GW_ACTIVATE_SCENE_REQ) moveNode(nodeIterator->second, sessionId, position.second, delay);
+        else stopNode(nodeIterator->second, delay);
+      }
+      if (_sessions.find(sessionId) == _sessions.end()) queueFrame(GW_SESSION_FINISHED_NTF, {payload[0], payload[1]}, delay);
+      break;
+    }
+    default:
+      queueFrame(GW_ERROR_NTF, {errorCommandUnknown}, delay);
+      break;
+  }
+}
+
+std::vector<uint8_t> Simulator::getNodeInformation(const Node &node) {
+  std::vector<uint8_t> payload(124, 0);
+  payload[0] = node.id;
+  payload[2] = node.id; //Order
+  std::copy_n(node.name.begin(), std::min(node.name.size(), (size_t)64), payload.begin() + 4);
+  payload[69] = node.type >> 8;
+  payload[70] = node.type & 0xFF;
+  payload[71] = 14; //Product group
+  payload[72] = 3; //Product type
+  payload[75] = 0x10; //Build number
+  std::copy_n(node.serialNumber, 8, payload.begin() + 76);
+  payload[84] = node.state;
+  payload[85] = node.position >> 8;
+  payload[86] = node.position & 0xFF;
+  payload[87] = node.target >> 8;
+  payload[88] = node.target & 0xFF;
+  for (size_t i = 89; i < 97; i += 2) {
+    payload[i] = 0xF7; //Functional parameters are not used
+  }
+  return payload;
+}
+
+std::vector<uint8_t> Simulator::getPositionChangedPayload(const Node &node) {
+  std::vector<uint8_t> payload(20, 0);
+  payload[0] = node.id;
+  payload[1] = node.state;
+  payload[2] = node.position >> 8;
+  payload[3] = node.position & 0xFF;
+  payload[4] = node.target >> 8;
+  payload[5] = node.target & 0xFF;
+  for (size_t i = 6; i < 14; i += 2) {
+    payload[i] = 0xF7;
+  }
+  uint32_t distance = node.target > node.position ? node.target - node.position : node.position - node.target;
+  uint32_t remainingTime = (uint32_t)((uint64_t)distance * _settings.travelTime / positionMax / 1000);
+  payload[14] = remainingTime >> 8;
+  payload[15] = remainingTime & 0xFF;
+  uint32_t timestamp = (uint32_t)std::time(nullptr);
+  payload[16] = timestamp >> 24;
+  payload[17] = (timestamp >> 16) & 0xFF;
+  payload[18] = (timestamp >> 8) & 0xFF;
+  payload[19] = timestamp & 0xFF;
+  return payload;
+}
+
+void Simulator::moveNode(Node &node, uint16_t sessionId, uint16_t target, int64_t delay) {
+  //A new command replaces the session the node was moving for
+  if (node.moving && node.sessionId != sessionId) {
+    auto sessionIterator = _sessions.find(node.sessionId);
+    if (sessionIterator != _sessions.end()) {
+      sessionIterator->second.erase(node.id);
+      if (sessionIterator->second.empty()) {
+        queueFrame(GW_SESSION_FINISHED_NTF, {(uint8_t)(node.sessionId >> 8), (uint8_t)(node.sessionId & 0xFF)}, delay);
+        _sessions.erase(sessionIterator);
+      }
+    }
+  }
+
+  node.sessionId = sessionId;
+  node.target = target;
+  if (node.position == target) {
+    node.moving = false;
+    node.state = stateDone;
+    queueFrame(GW_NODE_STATE_POSITION_CHANGED_NTF, getPositionChangedPayload(node), delay);
+    queueFrame(GW_COMMAND_RUN_STATUS_NTF, {(uint8_t)(sessionId >> 8), (uint8_t)(sessionId & 0xFF), 1, node.id, 0, (uint8_t)(node.position >> 8), (uint8_t)(node.position & 0xFF), runStatusCompleted, 1, 0, 0, 0, 0}, delay);
+    return;
+  }
+
+  node.moving = true;
+  node.state = stateExecuting;
+  node.lastMove = getTime() + delay;
+  node.lastNotification = node.lastMove;
+  _sessions[sessionId].emplace(node.id);
+  queueFrame(GW_COMMAND_RUN_STATUS_NTF, {(uint8_t)(sessionId >> 8), (uint8_t)(sessionId & 0xFF), 1, node.id, 0, (uint8_t)(node.position >> 8), (uint8_t)(node.position & 0xFF), runStatusActive, 1, 0, 0, 0, 0}, delay);
+  queueFrame(GW_NODE_STATE_POSITION_CHANGED_NTF, getPositionChangedPayload(node), delay);
+}
+
+void Simulator::stopNode(Node &node, int64_t delay) {
+  if (!node.moving) return;
+  node.target = node.position;
+  finishNode(node, delay);
+}
+
+void Simulator::finishNode(Node &node, int64_t delay) {
+  node.moving = false;
+  node.state = stateDone;
+  queueFrame(GW_NODE_STATE_POSITION_CHANGED_NTF, getPositionChangedPayload(node), delay);
+  queueFrame(GW_COMMAND_RUN_STATUS_NTF, {(uint8_t)(node.sessionId >> 8), (uint8_t)(node.sessionId & 0xFF), 1, node.id, 0, (uint8_t)(node.position >> 8), (uint8_t)(node.position & 0xFF), runStatusCompleted, 1, 0, 0, 0, 0}, delay);
+
+  auto sessionIterator = _sessions.find(node.sessionId);
+  if (sessionIterator == _sessions.end()) return;
+  sessionIterator->second.erase(node.id);
+  if (sessionIterator->second.empty()) {
+    queueFrame(GW_SESSION_FINISHED_NTF, {(uint8_t)(node.sessionId >> 8), (uint8_t)(node.sessionId & 0xFF)}, delay);
+    _sessions.erase(sessionIterator);
+  }
+}
+
+void Simulator::updateNodes() {
+  int64_t time = getTime();
+  for (auto &nodeIterator: _nodes) {
+    Node &node = nodeIterator.second;
+    if (!node.moving || time - node.lastNotification < _settings.notificationInterval) continue;
+
+    int64_t step = (time - node.lastMove) * positionMax / _settings.travelTime;
+    if (step <= 0) continue;
+    node.lastMove = time;
+    node.lastNotification = time;
+    if (node.target > node.position) node.position = (uint16_t)std::min((int64_t)node.target, node.position + step);
+    else node.position = (uint16_t)std::max((int64_t)node.target, node.position - step);
+
+    if (node.position == node.target) finishNode(node, 0);
+    else queueFrame(GW_NODE_STATE_POSITION_CHANGED_NTF, getPositionChangedPayload(node));
+  }
+}
+
+}
@@ -0,0 +1,160 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef VELUX_SIMULATOR_H
+#define VELUX_SIMULATOR_H
+
+#include "../src/PhysicalInterfaces/Slip.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Velux
+{
+
+/**
+ * Simulates a KLF200 gateway speaking the SLIP framed API over plain TCP. One client is served at a time.
+ */
+class Simulator
+{
+public:
+    struct Settings
+    {
+        std::string bindAddress = "127.0.0.1";
+        uint16_t port = 51200;
+        std::string password = "velux123";
+        int32_t nodeCount = 10;
+        int32_t sceneCount = 4;
+        //Delay in milliseconds before a request is answered
+        int32_t latency = 0;
+        //Random additional delay in milliseconds
+        int32_t latencyJitter = 0;
+        //Fraction of requests answered with GW_ERROR_NTF instead of a confirmation
+        double errorRate = 0;
+        //Fraction of requests that are not answered at all
+        double dropRate = 0;
+        //Time in milliseconds a node needs to move from 0 % to 100 %
+        int32_t travelTime = 20000;
+        //Time in milliseconds between two position notifications of a moving node
+        int32_t notificationInterval = 250;
+        uint32_t seed = 0;
+        bool verbose = false;
+    };
+
+    explicit Simulator(const Settings& settings);
+    virtual ~Simulator();
+
+    /**
+     * Accepts clients and serves them until stop() is called.
+     *
+     * @return Returns "0" on a clean exit.
+     */
+    int32_t run();
+    void stop() { _stop = true; }
+private:
+    struct Node
+    {
+        uint8_t id = 0;
+        std::string name;
+        uint16_t type = 0;
+        uint8_t serialNumber[8] = {};
+        uint16_t position = 0;
+        uint16_t target = 0;
+        uint8_t state = 5;
+        bool moving = false;
+        int64_t lastMove = 0;
+        int64_t lastNotification = 0;
+        uint16_t sessionId = 0;
+    };
+
+    struct Scene
+    {
+        uint8_t id = 0;
+        std::string name;
+        std::vector<std::pair<uint8_t, uint16_t>> positions;
+    };
+
+    struct ScheduledFrame
+    {
+        int64_t time = 0;
+        uint64_t sequence = 0;
+        std::vector<uint8_t> frame;
+
+        bool operator>(const ScheduledFrame& other) const { return time > other.time || (time == other.time && sequence > other.sequence); }
+    };
+
+    Settings _settings;
+    std::atomic_bool _stop{false};
+    std::mt19937 _random;
+    int32_t _serverSocket = -1;
+    int32_t _clientSocket = -1;
+    bool _authenticated = false;
+    Slip _slip;
+    uint64_t _sequence = 0;
+    std::priority_queue<ScheduledFrame, std::vector<ScheduledFrame>, std::greater<ScheduledFrame>> _outgoingFrames;
+    std::map<uint8_t, Node> _nodes;
+    std::vector<Scene> _scenes;
+    //Nodes still moving per session
+    std::map<uint16_t, std::set<uint8_t>> _sessions;
+
+    static int64_t getTime();
+    bool listen();
+    void serveClient();
+    void closeClient();
+
+    void createNodes();
+    void createScenes();
+
+    /**
+     * Builds a frame (ProtocolID, length, command, payload and checksum) and queues it for sending after "delay"
+     * milliseconds.
+     */
+    void queueFrame(uint16_t command, const std::vector<uint8_t>& payload, int64_t delay = 0);
+    void sendDueFrames();
+    int64_t getResponseDelay();
+
+    void processFrame(std::vector<uint8_t>& frame);
+    void processRequest(uint16_t command, const std::vector<uint8_t>& payload);
+    std::vector<uint8_t> getNodeInformation(const Node& node);
+    std::vector<uint8_t> getPositionChangedPayload(const Node& node);
+    void moveNode(Node& node, uint16_t sessionId, uint16_t target, int64_t delay);
+    void stopNode(Node& node, int64_t delay);
+    void finishNode(Node& node, int64_t delay);
+    void updateNodes();
+};
+
+}
+#endif
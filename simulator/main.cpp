@@ -0,0 +1,135 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "Simulator.h"
+
+#include <getopt.h>
+#include <signal.h>
+
+#include <iostream>
+
+namespace
+{
+Velux::Simulator* simulator = nullptr;
+
+void terminateHandler(int32_t)
+{
+    if(simulator) simulator->stop();
+}
+
+void printHelp()
+{
+    std::cout << "Usage: klf200-simulator [OPTIONS]" << std::endl << std::endl;
+    std::cout << "Simulates a KLF200 gateway on plain TCP for load and latency testing of the Velux KLF200 module." << std::endl << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  -a, --address ADDRESS        Address to listen on (default: 127.0.0.1)" << std::endl;
+    std::cout << "  -p, --port PORT              Port to listen on (default: 51200)" << std::endl;
+    std::cout << "  -P, --password PASSWORD      Gateway password (default: velux123)" << std::endl;
+    std::cout << "  -n, --nodes COUNT            Number of nodes, up to 200 (default: 10)" << std::endl;
+    std::cout << "  -s, --scenes COUNT           Number of scenes (default: 4)" << std::endl;
+    std::cout << "  -l, --latency MS             Response delay in milliseconds (default: 0)" << std::endl;
+    std::cout << "  -j, --jitter MS              Random additional response delay in milliseconds (default: 0)" << std::endl;
+    std::cout << "  -e, --error-rate FRACTION    Fraction of requests answered with GW_ERROR_NTF (default: 0)" << std::endl;
+    std::cout << "  -d, --drop-rate FRACTION     Fraction of requests not answered at all (default: 0)" << std::endl;
+    std::cout << "  -t, --travel-time MS         Time a node needs from 0 % to 100 % (default: 20000)" << std::endl;
+    std::cout << "  -i, --interval MS            Time between position notifications of a moving node (default: 250)" << std::endl;
+    std::cout << "  -S, --seed SEED              Seed of the random number generator (default: 0)" << std::endl;
+    std::cout << "  -v, --verbose                Print every request" << std::endl;
+    std::cout << "  -h, --help                   Show this help" << std::endl;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        Velux::Simulator::Settings settings;
+
+        static struct option longOptions[] =
+        {
+            {"address", required_argument, nullptr, 'a'},
+            {"port", required_argument, nullptr, 'p'},
+            {"password", required_argument, nullptr, 'P'},
+            {"nodes", required_argument, nullptr, 'n'},
+            {"scenes", required_argument, nullptr, 's'},
+            {"latency", required_argument, nullptr, 'l'},
+            {"jitter", required_argument, nullptr, 'j'},
+            {"error-rate", required_argument, nullptr, 'e'},
+            {"drop-rate", required_argument, nullptr, 'd'},
+            {"travel-time", required_argument, nullptr, 't'},
+            {"interval", required_argument, nullptr, 'i'},
+            {"seed", required_argument, nullptr, 'S'},
+            {"verbose", no_argument, nullptr, 'v'},
+            {"help", no_argument, nullptr, 'h'},
+            {nullptr, 0, nullptr, 0}
+        };
+
+        int32_t option = 0;
+        while((option = getopt_long(argc, argv, "a:p:P:n:s:l:j:e:d:t:i:S:vh", longOptions, nullptr)) != -1)
+        {
+            switch(option)
+            {
+                case 'a': settings.bindAddress = optarg; break;
+                case 'p': settings.port = (uint16_t)std::stoi(optarg); break;
+                case 'P': settings.password = optarg; break;
+                case 'n': settings.nodeCount = std::stoi(optarg); break;
+                case 's': settings.sceneCount = std::stoi(optarg); break;
+                case 'l': settings.latency = std::stoi(optarg); break;
+                case 'j': settings.latencyJitter = std::stoi(optarg); break;
+                case 'e': settings.errorRate = std::stod(optarg); break;
+                case 'd': settings.dropRate = std::stod(optarg); break;
+                case 't': settings.travelTime = std::stoi(optarg); break;
+                case 'i': settings.notificationInterval = std::stoi(optarg); break;
+                case 'S': settings.seed = (uint32_t)std::stoul(optarg); break;
+                case 'v': settings.verbose = true; break;
+                case 'h': printHelp(); return 0;
+                default: printHelp(); return 1;
+            }
+        }
+
+        Velux::Simulator localSimulator(settings);
+        simulator = &localSimulator;
+
+        struct sigaction sa{};
+        sa.sa_handler = terminateHandler;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+
+        int32_t result = localSimulator.run();
+        simulator = nullptr;
+        return result;
+    }
+    catch(const std::exception& ex)
+    {
+        std::cerr << "Error: " << ex.what() << std::endl;
+    }
+    return 1;
+}
@@ -47,16 +47,18 @@ void Interfaces::create()
 		for(auto settings : _physicalInterfaceSettings)
 		{
             std::shared_ptr<Klf200> device;
-            if(!settings.second || settings.second->host.empty()) continue;
+            if(!settings.second) continue;
+            //Replay interfaces never connect, so they don't need a host.
+            if(settings.second->host.empty() && settings.second->type != "klf200-replay") continue;
             GD::out.printDebug("Debug: Creating physical device. Type defined in veluxklf200.conf is: " + settings.second->type);
-            if(settings.second->type == "klf200") device.reset(new Klf200(settings.second));
+            if(settings.second->type == "klf200" || settings.second->type == "klf200-tcp" || settings.second->type == "klf200-replay") device.reset(new Klf200(settings.second));
             else GD::out.printError("Error: Unsupported physical device type: " + settings.second->type);
             if(device)
             {
                 if(_physicalInterfaces.find(settings.second->id) != _physicalInterfaces.end()) GD::out.printError("Error: id used for two devices: " + settings.second->id);
                 _physicalInterfaces[settings.second->id] = device;
                 GD::physicalInterfaces[settings.second->id] = device;
-                if(settings.second->isDefault || !GD::defaultPhysicalInterface) GD::defaultPhysicalInterface = device;
+                if(settings.second->isDefault || (!GD::defaultPhysicalInterface && !device->isReplayInterface())) GD::defaultPhysicalInterface = device;
             }
 		}
         if(!GD::defaultPhysicalInterface) GD::defaultPhysicalInterface = std::make_shared<Klf200>(std::make_shared<BaseLib::Systems::PhysicalInterfaceSettings>());
@@ -0,0 +1,116 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef ASYNCMUTEX_H
+#define ASYNCMUTEX_H
+
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace Velux
+{
+
+/**
+ * Mutex for coroutines. Waiting for the lock suspends the coroutine instead of blocking the thread. On unlock the lock
+ * is handed to the next waiting coroutine, which is resumed on the unlocking thread.
+ *
+ * Usage: auto guard = co_await mutex.lock();
+ */
+class AsyncMutex
+{
+public:
+    class Guard
+    {
+    public:
+        explicit Guard(AsyncMutex* mutex) : _mutex(mutex) {}
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        Guard(Guard&& other) noexcept : _mutex(std::exchange(other._mutex, nullptr)) {}
+
+        ~Guard()
+        {
+            if(_mutex) _mutex->unlock();
+        }
+    private:
+        AsyncMutex* _mutex = nullptr;
+    };
+
+    class LockAwaiter
+    {
+    public:
+        explicit LockAwaiter(AsyncMutex& mutex) : _mutex(mutex) {}
+
+        bool await_ready() { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::lock_guard<std::mutex> waitersGuard(_mutex._waitersMutex);
+            if(!_mutex._locked)
+            {
+                _mutex._locked = true;
+                return false;
+            }
+            _mutex._waiters.push_back(handle);
+            return true;
+        }
+
+        Guard await_resume() { return Guard(&_mutex); }
+    private:
+        AsyncMutex& _mutex;
+    };
+
+    LockAwaiter lock() { return LockAwaiter(*this); }
+private:
+    std::mutex _waitersMutex;
+    bool _locked = false;
+    std::deque<std::coroutine_handle<>> _waiters;
+
+    void unlock()
+    {
+        std::coroutine_handle<> next;
+        {
+            std::lock_guard<std::mutex> waitersGuard(_waitersMutex);
+            if(_waiters.empty())
+            {
+                _locked = false;
+                return;
+            }
+            //The lock stays taken and is passed on to the next coroutine.
+            next = _waiters.front();
+            _waiters.pop_front();
+        }
+        next.resume();
+    }
+};
+
+}
+#endif
@@ -28,6 +28,8 @@
  */
 
 #include "Klf200.h"
+#include "Slip.h"
+#include "TcpTransport.h"
 #include "../Velux.h"
 #include "../GD.h"
 
@@ -41,6 +43,14 @@ Klf200::Klf200(std::shared_ptr<BaseLib::Systems::PhysicalInterfaceSettings> sett
 
   _stopped = true;
 
+  auto packetTraceSetting = GD::family->getFamilySetting("packettracesize");
+  _packetTrace = std::make_unique<PacketTrace>(packetTraceSetting ? (size_t)std::max(packetTraceSetting->integerValue, 0) : 200);
+  _readBuffer.resize(1024);
+
+  for (auto command: VeluxPacket::getRequestCommands()) {
+    _latencies.emplace(command, std::make_unique<CommandLatency>());
+  }
+
   if (!settings) {
     _out.printCritical("Critical: Error initializing. Settings pointer is empty.");
     return;
@@ -48,12 +58,19 @@ Klf200::Klf200(std::shared_ptr<BaseLib::Systems::PhysicalInterfaceSettings> sett
   _hostname = settings->host;
   _port = BaseLib::Math::getNumber(settings->port);
   if (_port < 1 || _port > 65535) _port = 51200;
+  _tls = settings->type != "klf200-tcp";
+  _replayInterface = settings->type == "klf200-replay";
+
+  std::string id = settings->id;
+  auto setting = GD::family->getFamilySetting("eventthrottleinterval." + BaseLib::HelperFunctions::toLower(id));
+  if (!setting) setting = GD::family->getFamilySetting("eventthrottleinterval");
+  if (setting) _eventThrottleInterval = setting->integerValue < 0 ? 0 : setting->integerValue;
 }
 
 Klf200::~Klf200() {
+  stopReplay();
   stopListening();
   _bl->threadManager.join(_initThread);
-  _bl->threadManager.join(_heartbeatThread);
 }
 
 uint16_t Klf200::getMessageCounter() {
@@ -65,47 +82,62 @@ void Klf200::sendPacket(std::shared_ptr<BaseLib::Systems::Packet> packet) {
     PVeluxPacket veluxPacket(std::dynamic_pointer_cast<VeluxPacket>(packet));
     if (!veluxPacket) return;
 
-    auto response = getResponse(veluxPacket->getResponseCommand(), veluxPacket);
-    if (!response) _out.printError("Error sending packet " + BaseLib::HelperFunctions::getHexString(veluxPacket->getBinary()));
+    sendRequest(veluxPacket);
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+PVeluxPacket Klf200::sendRequest(const PVeluxPacket &packet) {
+  try {
+    auto response = getResponse(packet->getResponseCommand(), packet);
+    if (!response) _out.printError("Error sending packet " + BaseLib::HelperFunctions::getHexString(packet->getBinary()));
 
     _lastPacketSent = BaseLib::HelperFunctions::getTime();
+    return response;
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
+  return PVeluxPacket();
 }
 
 void Klf200::startListening() {
   try {
     stopListening();
+    stopReplay();
 
-    if (_hostname.empty()) {
-      _out.printError("Error: Configuration of KLF200 is incomplete (hostname is missing). Please correct it in \"veluxklf200.conf\".");
+    if (_replayInterface) {
+      //Only receives replayed captures
+      IPhysicalInterface::startListening();
       return;
     }
 
+    if (_customTransport) _transport = _customTransport;
+    else {
+      if (_hostname.empty()) {
+        _out.printError("Error: Configuration of KLF200 is incomplete (hostname is missing). Please correct it in \"veluxklf200.conf\".");
+        return;
+      }
+
+      _transport = std::make_shared<TcpTransport>(_hostname, (uint16_t)_port, _tls);
+    }
+
     if (_settings->password.empty()) {
       _out.printError("Error: Configuration of KLF200 is incomplete (password is missing). Please correct it in \"veluxklf200.conf\".");
       return;
     }
 
-    C1Net::TcpSocketInfo tcp_socket_info;
-    tcp_socket_info.read_timeout = 5000;
-    tcp_socket_info.write_timeout = 5000;
-
-    C1Net::TcpSocketHostInfo tcp_socket_host_info{
-        .host = _hostname,
-        .port = (uint16_t)_port,
-        .tls = true,
-        .verify_certificate = false,
-        .connection_retries = 1
-    };
-
-    _tcpSocket = std::make_unique<C1Net::TcpSocket>(tcp_socket_info, tcp_socket_host_info);
-
+    _reactor = Reactor::getInstance();
     _stopCallbackThread = false;
-    if (_settings->listenThreadPriority > -1) _bl->threadManager.start(_listenThread, true, _settings->listenThreadPriority, _settings->listenThreadPolicy, &Klf200::listen, this);
-    else _bl->threadManager.start(_listenThread, true, &Klf200::listen, this);
+    {
+      std::lock_guard<std::mutex> sendQueueGuard(_sendQueueMutex);
+      _stopSending = false;
+      _sendQueue.clear();
+      _writerPool = WriterPool::getInstance();
+    }
+    _bl->threadManager.start(_initThread, true, &Klf200::connect, this, false);
     IPhysicalInterface::startListening();
   }
   catch (const std::exception &ex) {
@@ -116,9 +148,23 @@ void Klf200::startListening() {
 void Klf200::stopListening() {
   try {
     _stopCallbackThread = true;
-    if (_tcpSocket) _tcpSocket->Shutdown();
-    _bl->threadManager.join(_listenThread);
+    if (_reactor) {
+      _reactor->cancelTimer(_reconnectTimer.exchange(0));
+      _reactor->cancelTimer(_heartbeatTimer.exchange(0));
+      disconnect();
+    }
+    if (_transport) _transport->close();
     _stopped = true;
+    _bl->threadManager.join(_initThread);
+    //Before "_reactor" is reset, because a failed send calls connectionLost().
+    stopSending();
+    if (_reactor) {
+      //Timers scheduled by callbacks that were running during the first cancellation
+      _reactor->cancelTimer(_reconnectTimer.exchange(0));
+      _reactor->cancelTimer(_heartbeatTimer.exchange(0));
+      disconnect();
+      _reactor.reset();
+    }
     IPhysicalInterface::stopListening();
   }
   catch (const std::exception &ex) {
@@ -126,14 +172,144 @@ void Klf200::stopListening() {
   }
 }
 
-void Klf200::init() {
+void Klf200::connect(bool reconnect) {
+  try {
+    if (_stopCallbackThread) return;
+    try {
+      _transport->open();
+    }
+    catch (const std::exception &ex) {
+      _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+    if (!_transport->isConnected()) {
+      scheduleReconnect();
+      return;
+    }
+    if (_stopCallbackThread) return;
+
+    _out.printInfo("Info: Successfully connected.");
+    if (reconnect) _reconnects++;
+    _slip.reset();
+    _readRegistration = _reactor->addFileDescriptor(_transport->getFileDescriptor(), std::bind(&Klf200::readTransport, this));
+    if (_readRegistration == 0) {
+      _out.printError("Error: Could not wait for data of the connection.");
+      _transport->close();
+      scheduleReconnect();
+      return;
+    }
+    _stopped = false;
+    scheduleHeartbeat();
+
+    //Only runs on this thread until the first request is sent. The rest of the initialization runs on the reactor.
+    initAsync().start([this](bool success) {
+      if (!success) connectionLost();
+    });
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+bool Klf200::disconnect() {
   try {
+    uint64_t readRegistration = _readRegistration.exchange(0);
+    if (readRegistration == 0) return false;
+    _reactor->removeFileDescriptor(readRegistration);
+    _reactor->cancelTimer(_heartbeatTimer.exchange(0));
+    _stopped = true;
+    _transport->close();
     {
-      std::lock_guard<std::mutex> requestsGuard(_responsesMutex);
-      _responses.clear();
-      _responseCollections.clear();
+      std::lock_guard<std::mutex> sendQueueGuard(_sendQueueMutex);
+      _sendQueue.clear();
     }
+    cancelRequests();
+    return true;
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+void Klf200::connectionLost() {
+  try {
+    if (!disconnect() || _stopCallbackThread) return;
+    _out.printWarning("Warning: Connection to device closed. Trying to reconnect...");
+    scheduleReconnect();
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
 
+void Klf200::scheduleReconnect() {
+  try {
+    if (_stopCallbackThread) return;
+    _reconnectTimer = _reactor->addTimer(15000, [this]() {
+      _reconnectTimer = 0;
+      if (_stopCallbackThread) return;
+      //The previous connection attempt already returned, so joining it doesn't block the reactor.
+      _bl->threadManager.start(_initThread, true, &Klf200::connect, this, true);
+    });
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void Klf200::scheduleHeartbeat() {
+  try {
+    if (_stopCallbackThread) return;
+    _heartbeatTimer = _reactor->addTimer(15000, [this]() {
+      _heartbeatTimer = 0;
+      if (_stopCallbackThread) return;
+      if (_stopped) {
+        //A request flow failed and flagged the connection as broken.
+        connectionLost();
+        return;
+      }
+      heartbeat();
+      scheduleHeartbeat();
+    });
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void Klf200::readTransport() {
+  try {
+    do {
+      size_t bytesRead = 0;
+      try {
+        bytesRead = _transport->read(_readBuffer.data(), _readBuffer.size());
+      }
+      catch (const C1Net::TimeoutException &ex) {
+        //The transport doesn't wait for data (see TcpTransport), so this is an incomplete TLS record. The rest makes the
+        //file descriptor readable again.
+        return;
+      }
+      catch (const C1Net::ClosedException &ex) {
+        connectionLost();
+        return;
+      }
+      if (bytesRead == 0) return;
+      if (bytesRead > _readBuffer.size()) bytesRead = _readBuffer.size();
+
+      _bytesReceived += bytesRead;
+      if (_packetCapture.isOpen()) _packetCapture.write(PacketTrace::Direction::received, _readBuffer.data(), bytesRead);
+      int64_t readTime = StageTrace::isEnabled() ? LatencyHistogram::getTime() : 0;
+      _slip.decode(_readBuffer.data(), bytesRead, [&](std::vector<uint8_t> &frame) { processPacket(frame, readTime); });
+    } while (_transport->hasBufferedData());
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    connectionLost();
+  }
+}
+
+Task<bool> Klf200::initAsync() {
+  try {
     {
       std::vector<uint8_t> payload;
       payload.reserve(32);
@@ -141,22 +317,22 @@ void Klf200::init() {
       payload.resize(32, 0);
       auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_PASSWORD_ENTER_REQ, payload);
 
-      auto responsePacket = getResponse(VeluxCommand::GW_PASSWORD_ENTER_CFM, veluxPacket);
+      auto responsePacket = co_await getResponseAsync(VeluxCommand::GW_PASSWORD_ENTER_CFM, veluxPacket);
       if (!responsePacket || responsePacket->getPayload().at(0) == 1) {
         _out.printError("Error: Could not login into KLF200. Please check your password.");
         _stopped = true;
-        return;
+        co_return false;
       }
     }
 
     {
       std::vector<uint8_t> payload;
       auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_GET_VERSION_REQ, payload);
-      auto responsePacket = getResponse(VeluxCommand::GW_GET_VERSION_CFM, veluxPacket);
+      auto responsePacket = co_await getResponseAsync(VeluxCommand::GW_GET_VERSION_CFM, veluxPacket);
       if (!responsePacket || responsePacket->getPayload().size() < 9) {
         _out.printError("Error: Could not get version information from KLF200.");
         _stopped = true;
-        return;
+        co_return false;
       }
 
       payload = responsePacket->getPayload();
@@ -166,7 +342,7 @@ void Klf200::init() {
       if (payload.at(7) != 14 || payload.at(8) != 3) {
         _out.printError("Error: Server is no KLF200.");
         _stopped = true;
-        return;
+        co_return false;
       }
 
       _out.printInfo("Info: Successfully connected to KLF200. Software version: " + version + "; hardware version: " + hardwareVersion);
@@ -175,11 +351,11 @@ void Klf200::init() {
     {
       std::vector<uint8_t> payload;
       auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_GET_PROTOCOL_VERSION_REQ, payload);
-      auto responsePacket = getResponse(VeluxCommand::GW_GET_PROTOCOL_VERSION_CFM, veluxPacket);
+      auto responsePacket = co_await getResponseAsync(VeluxCommand::GW_GET_PROTOCOL_VERSION_CFM, veluxPacket);
       if (!responsePacket || responsePacket->getPayload().size() < 4) {
         _out.printError("Error: Could not get protocol version from KLF200.");
         _stopped = true;
-        return;
+        co_return false;
       }
 
       payload = responsePacket->getPayload();
@@ -191,11 +367,11 @@ void Klf200::init() {
     {
       std::vector<uint8_t> payload;
       auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_HOUSE_STATUS_MONITOR_ENABLE_REQ, payload);
-      auto responsePacket = getResponse(VeluxCommand::GW_HOUSE_STATUS_MONITOR_ENABLE_CFM, veluxPacket);
+      auto responsePacket = co_await getResponseAsync(VeluxCommand::GW_HOUSE_STATUS_MONITOR_ENABLE_CFM, veluxPacket);
       if (!responsePacket) {
         _out.printError("Error: Could not enable house status monitor on KLF200.");
         _stopped = true;
-        return;
+        co_return false;
       }
     }
 
@@ -208,22 +384,22 @@ void Klf200::init() {
       payload.push_back((time >> 8) & 0xFF);
       payload.push_back(time & 0xFF);
       auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_SET_UTC_REQ, payload);
-      auto responsePacket = getResponse(VeluxCommand::GW_SET_UTC_CFM, veluxPacket);
+      auto responsePacket = co_await getResponseAsync(VeluxCommand::GW_SET_UTC_CFM, veluxPacket);
       if (!responsePacket) {
         _out.printError("Error: Could not set time on KLF200.");
         _stopped = true;
-        return;
+        co_return false;
       }
     }
 
     {
       std::vector<uint8_t> payload;
       auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_GET_STATE_REQ, payload);
-      auto responsePacket = getResponse(VeluxCommand::GW_GET_STATE_CFM, veluxPacket);
+      auto responsePacket = co_await getResponseAsync(VeluxCommand::GW_GET_STATE_CFM, veluxPacket);
       if (!responsePacket || responsePacket->getPayload().size() < 6) {
         _out.printError("Error: Could get state of KLF200.");
         _stopped = true;
-        return;
+        co_return false;
       }
 
       payload = responsePacket->getPayload();
@@ -233,389 +409,622 @@ void Klf200::init() {
       }
     }
 
-    _lastHeartBeat = BaseLib::HelperFunctions::getTime();
-
     _out.printInfo("Info: Initialization complete.");
+    co_return true;
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
+  co_return false;
 }
 
 void Klf200::heartbeat() {
   try {
+    //The previous heartbeat is still waiting for its response.
+    if (_heartbeatRunning.exchange(true)) return;
     std::vector<uint8_t> payload;
     auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_GET_STATE_REQ, payload);
-    auto responsePacket = getResponse(VeluxCommand::GW_GET_STATE_CFM, veluxPacket, 60);
-    if (!responsePacket) {
-      _out.printError("Error: Could get state of KLF200.");
-      _stopped = true;
-      return;
-    }
+    getResponseAsync(VeluxCommand::GW_GET_STATE_CFM, veluxPacket, 60).start([this](PVeluxPacket responsePacket) {
+      _heartbeatRunning = false;
+      if (!responsePacket) {
+        _out.printError("Error: Could get state of KLF200.");
+        _stopped = true;
+        connectionLost();
+      }
+    });
   }
   catch (const std::exception &ex) {
+    _heartbeatRunning = false;
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
 }
 
-void Klf200::listen() {
+void Klf200::processPacket(std::vector<uint8_t> &data, int64_t readTime) {
   try {
-    try {
-      _tcpSocket->Open();
-      if (_tcpSocket->Connected()) {
-        _out.printInfo("Info: Successfully connected.");
-        _stopped = false;
-        _bl->threadManager.start(_initThread, true, &Klf200::init, this);
-      }
-      _lastHeartBeat = BaseLib::HelperFunctions::getTime();
-    }
-    catch (const std::exception &ex) {
-      _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    int64_t receiveTime = LatencyHistogram::getTime();
+    _packetTrace->add(PacketTrace::Direction::received, data);
+    auto veluxPacket = std::make_shared<VeluxPacket>(data);
+    if (readTime != 0) {
+      veluxPacket->setStageTime(StageTrace::Stage::socketRead, readTime);
+      veluxPacket->setStageTime(StageTrace::Stage::slipFrameComplete, receiveTime);
+      veluxPacket->setStageTime(StageTrace::Stage::packetConstructed, LatencyHistogram::getTime());
     }
+    _framesReceived++;
+    getCommandCounters(veluxPacket->getCommand()).received++;
 
-    std::vector<uint8_t> buffer(1024);
-    std::vector<uint8_t> buffer2;
-    buffer2.reserve(1024);
-    bool more_data = false;
-    bool escape = false;
-    while (!_stopCallbackThread) {
-      try {
-        if (_stopped || !_tcpSocket->Connected()) {
-          if (_stopCallbackThread) return;
-          if (_stopped) _out.printWarning("Warning: Connection to device closed. Trying to reconnect...");
-          _tcpSocket->Shutdown();
-          for (int32_t i = 0; i < 15; i++) {
-            if (_stopCallbackThread) continue;
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-          }
-          _tcpSocket->Open();
-          if (_tcpSocket->Connected()) {
-            _out.printInfo("Info: Successfully connected.");
-            _stopped = false;
-            _bl->threadManager.start(_initThread, true, &Klf200::init, this);
-          }
-          _lastHeartBeat = BaseLib::HelperFunctions::getTime();
-          continue;
-        }
-
-        int32_t bytesRead = 0;
-        try {
-          bytesRead = _tcpSocket->Read(buffer.data(), buffer.size(), more_data);
-        }
-        catch (C1Net::TimeoutException &ex) {
-          if (_stopCallbackThread) continue;
-          if (BaseLib::HelperFunctions::getTime() - _lastHeartBeat > 15000) {
-            _lastHeartBeat = BaseLib::HelperFunctions::getTime();
-            _bl->threadManager.start(_heartbeatThread, false, &Klf200::heartbeat, this);
+    std::shared_ptr<Request> request;
+    bool collected = false;
+    {
+      std::lock_guard<std::mutex> responsesGuard(_responsesMutex);
+      auto responsesIterator = _responses.find(veluxPacket->getCommand());
+      if (responsesIterator != _responses.end()) request = responsesIterator->second;
+      else {
+        auto responseCollectionsIterator = _responseCollections.find(veluxPacket->getCommand());
+        if (responseCollectionsIterator != _responseCollections.end()) {
+          collected = true;
+          auto &collection = *responseCollectionsIterator->second;
+          if (collection.packets.empty()) collection.firstPacketTime = receiveTime;
+          collection.packets.push_back(veluxPacket);
+          if (collection.remainingPacketsByte) {
+            auto &payload = veluxPacket->getPayload();
+            int32_t index = *collection.remainingPacketsByte < 0 ? (int32_t)payload.size() + *collection.remainingPacketsByte : *collection.remainingPacketsByte;
+            if (index >= 0 && index < (int32_t)payload.size() && payload[index] == 0) request = collection.finishedRequest;
           }
-          continue;
-        }
-        if (bytesRead <= 0) continue;
-        if (bytesRead > 1024) bytesRead = 1024;
-
-        if (GD::bl->debugLevel >= 5) _out.printDebug("Debug: TCP packet received: " + BaseLib::HelperFunctions::getHexString(buffer.data(), bytesRead));
-
-        for (int32_t i = 0; i < bytesRead; i++) {
-          if (buffer.at(i) == 0xC0) {
-            escape = false;
-            if (buffer2.empty()) continue;
-            else {
-              processPacket(buffer2);
-              buffer2.clear();
-              continue;
-            }
-          } else if (buffer.at(i) == 0xDB) {
-            escape = true;
-          } else if (escape) {
-            if (buffer.at(i) == 0xDC) buffer2.push_back(0xC0);
-            else if (buffer.at(i) == 0xDD) buffer2.push_back(0xDB);
-          } else buffer2.push_back(buffer.at(i));
         }
       }
-      catch (const std::exception &ex) {
-        _stopped = true;
-        _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
-      }
     }
+    //Resumes the waiting coroutine on this thread.
+    if (request) completeRequest(request, veluxPacket, receiveTime);
+    if (request || collected) return;
+
+    processSessionNotification(veluxPacket, receiveTime);
+    raisePacketReceived(veluxPacket);
+  }
+  catch (const InvalidVeluxPacketException &ex) {
+    if (ex.getReason() == InvalidVeluxPacketException::Reason::checksum) _checksumErrors++;
+    else if (ex.getReason() == InvalidVeluxPacketException::Reason::length) _lengthErrors++;
+    else _otherFrameErrors++;
+    _out.printWarning("Warning: Invalid frame received (" + std::string(ex.what()) + "): " + BaseLib::HelperFunctions::getHexString(data));
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
 }
 
-std::vector<uint8_t> Klf200::slipEncode(const std::vector<uint8_t> &data) {
+bool Klf200::prepareReplay(const std::string &filename, std::vector<PacketCapture::Record> &records) {
+  if (!_replayInterface) {
+    _out.printError("Error: Captures can only be replayed on interfaces of type \"klf200-replay\".");
+    return false;
+  }
+  if (_replaying.exchange(true)) {
+    _out.printError("Error: Another replay is running.");
+    return false;
+  }
+  if (!PacketCapture::read(filename, records)) {
+    _replaying = false;
+    _out.printError("Error: Could not read capture file " + filename);
+    return false;
+  }
+  return true;
+}
+
+bool Klf200::replay(const std::string &filename, ReplayResult &result) {
   try {
-    std::vector<uint8_t> result;
-    result.reserve(data.size() * 120 / 100); //Assume a maximum of 20% size increase
-
-    result.push_back(0xC0); //SLIP start
-    for (auto byte: data) {
-      if (byte == 0xC0) {
-        //Escape start byte
-        result.push_back(0xDB);
-        result.push_back(0xDC);
-      } else if (byte == 0xDB) {
-        //Escape escape byte
-        result.push_back(0xDB);
-        result.push_back(0xDD);
-      } else result.push_back(byte);
-    }
-    result.push_back(0xC0); //SLIP end
-    return result;
+    result = ReplayResult();
+    std::vector<PacketCapture::Record> records;
+    if (!prepareReplay(filename, records)) return false;
+    replayRecords(records, false, result);
+    _replaying = false;
+    return true;
   }
   catch (const std::exception &ex) {
+    _replaying = false;
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  return std::vector<uint8_t>();
+  return false;
 }
 
-void Klf200::processPacket(std::vector<uint8_t> &data) {
+bool Klf200::startReplay(const std::string &filename) {
   try {
-    auto veluxPacket = std::make_shared<VeluxPacket>(data);
+    std::vector<PacketCapture::Record> records;
+    if (!prepareReplay(filename, records)) return false;
+    _bl->threadManager.join(_replayThread);
+    _stopReplay = false;
+    _bl->threadManager.start(_replayThread, false, &Klf200::replayThread, this, std::move(records));
+    return true;
+  }
+  catch (const std::exception &ex) {
+    _replaying = false;
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+void Klf200::stopReplay() {
+  _stopReplay = true;
+  _bl->threadManager.join(_replayThread);
+}
+
+void Klf200::replayThread(std::vector<PacketCapture::Record> records) {
+  try {
+    ReplayResult result;
+    replayRecords(records, true, result);
+    double seconds = (double)result.duration / 1000000000.0;
+    _out.printInfo("Info: Replayed " + std::to_string(result.frames) + " frames (" + std::to_string(result.bytes) + " bytes, " + std::to_string(result.records) + " records) in " + std::to_string(seconds) + " s.");
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  _replaying = false;
+}
 
-    std::unique_lock<std::mutex> requestsGuard(_responsesMutex);
-    auto responsesIterator = _responses.find(veluxPacket->getCommand());
-    auto responseCollectionsIterator = _responseCollections.find(veluxPacket->getCommand());
-    if (responsesIterator != _responses.end()) {
-      auto request = responsesIterator->second;
-      requestsGuard.unlock();
-      request->response = veluxPacket;
-      {
-        std::lock_guard<std::mutex> lock(request->mutex);
-        request->mutexReady = true;
+void Klf200::replayRecords(const std::vector<PacketCapture::Record> &records, bool originalPace, ReplayResult &result) {
+  Slip slip;
+  auto startTime = std::chrono::steady_clock::now();
+  for (auto &record: records) {
+    if (_stopReplay) break;
+    result.records++;
+    if (record.direction != PacketTrace::Direction::received) continue;
+    if (originalPace) {
+      //Sleep in steps, so stopReplay() doesn't have to wait for long pauses of the capture.
+      auto recordTime = startTime + std::chrono::nanoseconds(record.time);
+      while (!_stopReplay && std::chrono::steady_clock::now() < recordTime) {
+        std::this_thread::sleep_until(std::min(recordTime, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)));
       }
-      request->conditionVariable.notify_one();
-      return;
-    } else if (responseCollectionsIterator != _responseCollections.end()) {
-      responseCollectionsIterator->second.push_back(veluxPacket);
-      requestsGuard.unlock();
-      return;
-    } else requestsGuard.unlock();
+      if (_stopReplay) break;
+    }
+    result.bytes += record.data.size();
+    int64_t readTime = StageTrace::isEnabled() ? LatencyHistogram::getTime() : 0;
+    slip.decode(record.data.data(), record.data.size(), [&](std::vector<uint8_t> &frame) {
+      result.frames++;
+      processPacket(frame, readTime);
+    });
+  }
+  result.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
 
-    raisePacketReceived(veluxPacket);
+bool Klf200::ResponseAwaiter::await_ready() {
+  std::lock_guard<std::mutex> requestGuard(_request->mutex);
+  return _request->completed;
+}
+
+bool Klf200::ResponseAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  std::lock_guard<std::mutex> requestGuard(_request->mutex);
+  if (_request->completed) return false;
+  _request->waiter = handle;
+  if (_interface._reactor) {
+    std::weak_ptr<Request> weakRequest = _request;
+    Klf200 *interface = &_interface;
+    _request->timeoutTimer = _interface._reactor->addTimer(_timeout, [interface, weakRequest]() {
+      auto request = weakRequest.lock();
+      if (request) interface->completeRequest(request, PVeluxPacket(), 0);
+    });
+  }
+  return true;
+}
+
+void Klf200::completeRequest(const std::shared_ptr<Request> &request, const PVeluxPacket &response, int64_t responseTime) {
+  std::coroutine_handle<> waiter;
+  uint64_t timeoutTimer = 0;
+  {
+    std::lock_guard<std::mutex> requestGuard(request->mutex);
+    if (request->completed) return;
+    request->completed = true;
+    request->response = response;
+    request->responseTime = responseTime;
+    waiter = std::exchange(request->waiter, nullptr);
+    timeoutTimer = request->timeoutTimer;
+  }
+  if (timeoutTimer != 0 && _reactor) _reactor->cancelTimer(timeoutTimer);
+  if (waiter) waiter.resume();
+}
+
+void Klf200::cancelRequests() {
+  try {
+    std::vector<std::shared_ptr<Request>> requests;
+    {
+      std::lock_guard<std::mutex> responsesGuard(_responsesMutex);
+      for (auto &response: _responses) {
+        requests.push_back(response.second);
+      }
+      for (auto &collection: _responseCollections) {
+        requests.push_back(collection.second->finishedRequest);
+      }
+    }
+    for (auto &request: requests) {
+      completeRequest(request, PVeluxPacket(), 0);
+    }
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
 }
 
+void Klf200::removeResponse(VeluxCommand responseCommand, const std::shared_ptr<Request> &request) {
+  std::lock_guard<std::mutex> responsesGuard(_responsesMutex);
+  auto responsesIterator = _responses.find(responseCommand);
+  if (responsesIterator != _responses.end() && responsesIterator->second == request) _responses.erase(responsesIterator);
+}
+
 PVeluxPacket Klf200::getResponse(VeluxCommand responseCommand, const PVeluxPacket &requestPacket, int32_t waitForSeconds) {
+  return getResponseAsync(responseCommand, requestPacket, waitForSeconds).get();
+}
+
+Task<PVeluxPacket> Klf200::getResponseAsync(VeluxCommand responseCommand, PVeluxPacket requestPacket, int32_t waitForSeconds) {
   try {
-    if (_stopped) return PVeluxPacket();
+    if (_stopped) co_return PVeluxPacket();
 
-    std::lock_guard<std::mutex> sendPacketGuard(_sendPacketMutex);
-    std::lock_guard<std::mutex> getResponseGuard(_getResponseMutex);
-    std::shared_ptr<Request> request = std::make_shared<Request>();
-    std::unique_lock<std::mutex> requestsGuard(_responsesMutex);
-    _responses[responseCommand] = request;
-    requestsGuard.unlock();
-    std::unique_lock<std::mutex> lock(request->mutex);
+    auto requestGuard = co_await _requestMutex.lock();
+    auto request = std::make_shared<Request>();
+    {
+      std::lock_guard<std::mutex> responsesGuard(_responsesMutex);
+      //Checked while holding the lock, so either cancelRequests() sees the request or the request sees "_stopped".
+      if (_stopped) co_return PVeluxPacket();
+      _responses[responseCommand] = request;
+    }
 
     auto requestBinary = requestPacket->getBinary();
-    auto slipPacket = slipEncode(requestBinary);
+    auto slipPacket = Slip::encode(requestBinary);
 
-    try {
-      GD::out.printInfo("Info: Sending packet " + BaseLib::HelperFunctions::getHexString(slipPacket));
-      _tcpSocket->Send(slipPacket);
-    }
-    catch (const C1Net::Exception &ex) {
-      _out.printError("Error sending packet: " + std::string(ex.what()));
-      return PVeluxPacket();
-    }
+    int64_t requestTime = LatencyHistogram::getTime();
+    addPendingSession(requestPacket, requestTime, request);
 
-    int32_t i = 0;
-    while (!request->conditionVariable.wait_for(lock, std::chrono::milliseconds(1000), [&] {
-      i++;
-      return request->mutexReady || _stopped || i == waitForSeconds;
-    }));
+    send(requestPacket->getCommand(), requestBinary, slipPacket);
+    co_await ResponseAwaiter(*this, request, waitForSeconds * 1000);
+    removeResponse(responseCommand, request);
 
-    if (i == waitForSeconds || !request->response) {
+    if (!request->response) {
+      removePendingSession(requestPacket);
+      _timeouts++;
       _out.printError("Error: No response received to packet: " + BaseLib::HelperFunctions::getHexString(slipPacket));
-      return PVeluxPacket();
+      co_return PVeluxPacket();
     }
 
-    auto responsePacket = request->response;
-
-    requestsGuard.lock();
-    _responses.erase(responseCommand);
-    requestsGuard.unlock();
+    auto latency = getLatency(requestPacket->getCommand());
+    if (latency) latency->requestToConfirmation.record(request->responseTime - requestTime);
 
-    return responsePacket;
+    co_return request->response;
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  return PVeluxPacket();
+  co_return PVeluxPacket();
 }
 
-std::pair<PVeluxPacket, std::list<PVeluxPacket>> Klf200::getMultipleResponses(VeluxCommand responseCommand, VeluxCommand notificationCommand, VeluxCommand finishedCommand, const PVeluxPacket &requestPacket, int32_t waitForSeconds) {
-  try {
-    std::pair<PVeluxPacket, std::list<PVeluxPacket>> returnValue;
-    if (_stopped) return returnValue;
-
-    std::lock_guard<std::mutex> sendPacketGuard(_sendPacketMutex);
-    std::lock_guard<std::mutex> getResponseGuard(_getResponseMutex);
-    std::shared_ptr<Request> request = std::make_shared<Request>();
-    std::shared_ptr<Request> finishedRequest = std::make_shared<Request>();
-    std::unique_lock<std::mutex> responsesGuard(_responsesMutex);
-    _responses[responseCommand] = request;
-    _responses[finishedCommand] = finishedRequest;
-    _responseCollections[notificationCommand] = std::list<PVeluxPacket>();
-    responsesGuard.unlock();
-    std::unique_lock<std::mutex> lock(request->mutex);
+Task<std::pair<PVeluxPacket, std::list<PVeluxPacket>>> Klf200::getMultipleResponsesAsync(VeluxCommand responseCommand, VeluxCommand notificationCommand, VeluxCommand finishedCommand, PVeluxPacket requestPacket, int32_t waitForSeconds) {
+  return collectResponsesAsync(responseCommand, notificationCommand, finishedCommand, std::optional<int32_t>(), std::optional<int32_t>(), std::move(requestPacket), waitForSeconds);
+}
 
-    auto requestBinary = requestPacket->getBinary();
-    auto slipPacket = slipEncode(requestBinary);
+Task<std::pair<PVeluxPacket, std::list<PVeluxPacket>>> Klf200::getMultipleResponsesAsync(VeluxCommand responseCommand, VeluxCommand notificationCommand, int32_t remainingPacketsByte, std::optional<int32_t> countByte, PVeluxPacket requestPacket, int32_t waitForSeconds) {
+  return collectResponsesAsync(responseCommand, notificationCommand, VeluxCommand::UNSET, remainingPacketsByte, countByte, std::move(requestPacket), waitForSeconds);
+}
+
+Task<std::pair<PVeluxPacket, std::list<PVeluxPacket>>> Klf200::collectResponsesAsync(VeluxCommand responseCommand, VeluxCommand notificationCommand, VeluxCommand finishedCommand, std::optional<int32_t> remainingPacketsByte, std::optional<int32_t> countByte, PVeluxPacket requestPacket, int32_t waitForSeconds) {
+  std::pair<PVeluxPacket, std::list<PVeluxPacket>> returnValue;
+  try {
+    if (_stopped) co_return returnValue;
 
+    auto requestGuard = co_await _requestMutex.lock();
+    auto request = std::make_shared<Request>();
+    auto collection = std::make_shared<ResponseCollection>();
+    collection->remainingPacketsByte = remainingPacketsByte;
+    collection->finishedRequest = std::make_shared<Request>();
     {
-      try {
-        GD::out.printInfo("Info: Sending packet " + BaseLib::HelperFunctions::getHexString(slipPacket));
-        _tcpSocket->Send(slipPacket);
-      }
-      catch (const C1Net::Exception &ex) {
-        _out.printError("Error sending packet: " + std::string(ex.what()));
-        return returnValue;
-      }
+      std::lock_guard<std::mutex> responsesGuard(_responsesMutex);
+      if (_stopped) co_return returnValue;
+      _responses[responseCommand] = request;
+      if (finishedCommand != VeluxCommand::UNSET) _responses[finishedCommand] = collection->finishedRequest;
+      _responseCollections[notificationCommand] = collection;
+    }
 
-      int32_t i = 0;
-      while (!request->conditionVariable.wait_for(lock, std::chrono::milliseconds(1000), [&] {
-        i++;
-        return request->mutexReady || _stopped || i == 15;
-      }));
+    auto requestBinary = requestPacket->getBinary();
+    auto slipPacket = Slip::encode(requestBinary);
 
-      if (i == 15 || !request->response) {
-        _out.printError("Error: No response received to packet: " + BaseLib::HelperFunctions::getHexString(slipPacket));
-        return returnValue;
-      }
+    auto latency = getLatency(requestPacket->getCommand());
+    int64_t requestTime = LatencyHistogram::getTime();
 
-      returnValue.first = request->response;
+    send(requestPacket->getCommand(), requestBinary, slipPacket);
+    co_await ResponseAwaiter(*this, request, 15000);
+    removeResponse(responseCommand, request);
 
-      responsesGuard.lock();
-      _responses.erase(responseCommand);
-      responsesGuard.unlock();
+    if (!request->response) {
+      _timeouts++;
+      _out.printError("Error: No response received to packet: " + BaseLib::HelperFunctions::getHexString(slipPacket));
+    } else {
+      returnValue.first = request->response;
+      if (latency) latency->requestToConfirmation.record(request->responseTime - requestTime);
+
+      auto &responsePayload = request->response->getPayload();
+      bool emptyList = countByte && *countByte < (signed)responsePayload.size() && responsePayload.at(*countByte) == 0;
+      if (!emptyList) co_await ResponseAwaiter(*this, collection->finishedRequest, waitForSeconds * 1000);
+      if (!emptyList && !collection->finishedRequest->response) {
+        _timeouts++;
+        if (finishedCommand != VeluxCommand::UNSET) _out.printWarning("Warning: No \"finished\" response received to packet: " + BaseLib::HelperFunctions::getHexString(slipPacket));
+        else _out.printWarning("Warning: Not all response packets have been received before timeout for request: " + BaseLib::HelperFunctions::getHexString(slipPacket));
+      }
     }
 
     {
-      int32_t i = 0;
-      while (!finishedRequest->conditionVariable.wait_for(lock, std::chrono::milliseconds(1000), [&] {
-        i++;
-        return finishedRequest->mutexReady || _stopped || i == waitForSeconds;
-      }));
-
-      if (i == waitForSeconds || !finishedRequest->response) {
-        _out.printWarning("Warning: No \"finished\" response received to packet: " + BaseLib::HelperFunctions::getHexString(slipPacket));
+      std::lock_guard<std::mutex> responsesGuard(_responsesMutex);
+      if (finishedCommand != VeluxCommand::UNSET) {
+        auto responsesIterator = _responses.find(finishedCommand);
+        if (responsesIterator != _responses.end() && responsesIterator->second == collection->finishedRequest) _responses.erase(responsesIterator);
       }
+      auto responseCollectionsIterator = _responseCollections.find(notificationCommand);
+      if (responseCollectionsIterator != _responseCollections.end() && responseCollectionsIterator->second == collection) _responseCollections.erase(responseCollectionsIterator);
+      //Only read after the collection is removed, because the reactor thread appends to it.
+      if (returnValue.first) returnValue.second = std::move(collection->packets);
+    }
 
-      responsesGuard.lock();
-      returnValue.second = _responseCollections[notificationCommand];
-      _responses.erase(finishedCommand);
-      _responseCollections.erase(notificationCommand);
-      responsesGuard.unlock();
+    if (latency && returnValue.first) {
+      if (!returnValue.second.empty()) latency->confirmationToFirstNotification.record(collection->firstPacketTime - request->responseTime);
+      if (collection->finishedRequest->response) latency->requestToFinished.record(collection->finishedRequest->responseTime - requestTime);
     }
 
-    return returnValue;
+    co_return returnValue;
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  return std::pair<PVeluxPacket, std::list<PVeluxPacket>>();
+  co_return std::pair<PVeluxPacket, std::list<PVeluxPacket>>();
 }
 
-std::pair<PVeluxPacket, std::list<PVeluxPacket>> Klf200::getMultipleResponses(VeluxCommand responseCommand, VeluxCommand notificationCommand, int32_t remainingPacketsByte, const PVeluxPacket &requestPacket, int32_t waitForSeconds) {
-  try {
-    std::pair<PVeluxPacket, std::list<PVeluxPacket>> returnValue;
-    if (_stopped) return returnValue;
-
-    std::lock_guard<std::mutex> sendPacketGuard(_sendPacketMutex);
-    std::lock_guard<std::mutex> getResponseGuard(_getResponseMutex);
-    std::shared_ptr<Request> request = std::make_shared<Request>();
-    std::shared_ptr<Request> finishedRequest = std::make_shared<Request>();
-    std::unique_lock<std::mutex> responsesGuard(_responsesMutex);
-    _responses[responseCommand] = request;
-    _responseCollections[notificationCommand] = std::list<PVeluxPacket>();
-    responsesGuard.unlock();
-    std::unique_lock<std::mutex> lock(request->mutex);
+Klf200::CommandCounters &Klf200::getCommandCounters(VeluxCommand command) {
+  {
+    std::shared_lock<std::shared_mutex> commandCountersGuard(_commandCountersMutex);
+    auto commandCountersIterator = _commandCounters.find((uint16_t)command);
+    if (commandCountersIterator != _commandCounters.end()) return *commandCountersIterator->second;
+  }
+  std::unique_lock<std::shared_mutex> commandCountersGuard(_commandCountersMutex);
+  auto &commandCounters = _commandCounters[(uint16_t)command];
+  if (!commandCounters) commandCounters = std::make_unique<CommandCounters>();
+  return *commandCounters;
+}
 
-    auto requestBinary = requestPacket->getBinary();
-    auto slipPacket = slipEncode(requestBinary);
+void Klf200::send(VeluxCommand command, const std::vector<uint8_t> &requestBinary, const std::vector<uint8_t> &slipPacket) {
+  _packetTrace->add(PacketTrace::Direction::sent, requestBinary);
+  {
+    std::lock_guard<std::mutex> sendQueueGuard(_sendQueueMutex);
+    _sendQueue.push_back(slipPacket);
+    if (!_sendScheduled && !_stopSending && _writerPool) {
+      _sendScheduled = true;
+      _writerPool->post(std::bind(&Klf200::flushSendQueue, this));
+    }
+  }
+  _framesSent++;
+  getCommandCounters(command).sent++;
+}
 
+void Klf200::flushSendQueue() {
+  while (true) {
+    std::vector<uint8_t> slipPacket;
     {
-      try {
-        GD::out.printInfo("Info: Sending packet " + BaseLib::HelperFunctions::getHexString(slipPacket));
-        _tcpSocket->Send(slipPacket);
-      }
-      catch (const C1Net::Exception &ex) {
-        _out.printError("Error sending packet: " + std::string(ex.what()));
-        return returnValue;
+      std::lock_guard<std::mutex> sendQueueGuard(_sendQueueMutex);
+      if (_stopSending || _sendQueue.empty()) {
+        _sendScheduled = false;
+        _sendQueueConditionVariable.notify_all();
+        return;
       }
+      slipPacket = std::move(_sendQueue.front());
+      _sendQueue.pop_front();
+    }
 
-      int32_t i = 0;
-      while (!request->conditionVariable.wait_for(lock, std::chrono::milliseconds(1000), [&] {
-        i++;
-        return request->mutexReady || _stopped || i == 15;
-      }));
+    try {
+      if (_packetCapture.isOpen()) _packetCapture.write(PacketTrace::Direction::sent, slipPacket.data(), slipPacket.size());
+      _transport->send(slipPacket);
+      _bytesSent += slipPacket.size();
+    }
+    catch (const C1Net::Exception &ex) {
+      _out.printError("Error sending packet: " + std::string(ex.what()));
+      connectionLost();
+    }
+    catch (const std::exception &ex) {
+      _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
 
-      if (i == 15 || !request->response) {
-        _out.printError("Error: No response received to packet: " + BaseLib::HelperFunctions::getHexString(slipPacket));
-        return returnValue;
-      }
+void Klf200::stopSending() {
+  //Released after unlocking, because the last release joins the threads of the pool.
+  std::shared_ptr<WriterPool> writerPool;
+  {
+    std::unique_lock<std::mutex> sendQueueGuard(_sendQueueMutex);
+    _stopSending = true;
+    _sendQueue.clear();
+    //Wait for a running flushSendQueue()
+    _sendQueueConditionVariable.wait(sendQueueGuard, [&] { return !_sendScheduled; });
+    writerPool = std::move(_writerPool);
+  }
+}
 
-      returnValue.first = request->response;
+PVariable Klf200::getMetrics() {
+  try {
+    auto metrics = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tStruct);
+    metrics->structValue->emplace("bytesReceived", std::make_shared<BaseLib::Variable>((int64_t)_bytesReceived.load()));
+    metrics->structValue->emplace("bytesSent", std::make_shared<BaseLib::Variable>((int64_t)_bytesSent.load()));
+    metrics->structValue->emplace("framesReceived", std::make_shared<BaseLib::Variable>((int64_t)_framesReceived.load()));
+    metrics->structValue->emplace("framesSent", std::make_shared<BaseLib::Variable>((int64_t)_framesSent.load()));
+    metrics->structValue->emplace("lengthErrors", std::make_shared<BaseLib::Variable>((int64_t)_lengthErrors.load()));
+    metrics->structValue->emplace("checksumErrors", std::make_shared<BaseLib::Variable>((int64_t)_checksumErrors.load()));
+    metrics->structValue->emplace("otherFrameErrors", std::make_shared<BaseLib::Variable>((int64_t)_otherFrameErrors.load()));
+    metrics->structValue->emplace("timeouts", std::make_shared<BaseLib::Variable>((int64_t)_timeouts.load()));
+    metrics->structValue->emplace("reconnects", std::make_shared<BaseLib::Variable>((int64_t)_reconnects.load()));
 
-      responsesGuard.lock();
-      _responses.erase(responseCommand);
-      responsesGuard.unlock();
+    {
+      std::lock_guard<std::mutex> responsesGuard(_responsesMutex);
+      metrics->structValue->emplace("pendingRequests", std::make_shared<BaseLib::Variable>((int64_t)_responses.size()));
+    }
+    {
+      std::lock_guard<std::mutex> pendingSessionsGuard(_pendingSessionsMutex);
+      metrics->structValue->emplace("pendingSessions", std::make_shared<BaseLib::Variable>((int64_t)_pendingSessions.size()));
+    }
+    {
+      std::lock_guard<std::mutex> sendQueueGuard(_sendQueueMutex);
+      metrics->structValue->emplace("sendQueueDepth", std::make_shared<BaseLib::Variable>((int64_t)_sendQueue.size()));
     }
 
+    auto framesReceivedByCommand = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tStruct);
+    auto framesSentByCommand = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tStruct);
     {
-      int32_t i = 0;
-      int32_t remainingPackets = 1;
-      for (; i < waitForSeconds; i++) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-        responsesGuard.lock();
-        std::list<PVeluxPacket> &collection = _responseCollections[notificationCommand];
-        if (!collection.empty()) {
-          auto payload = collection.back()->getPayload();
-          if (remainingPackets < 0) {
-            if (payload.size() - remainingPackets >= 0) {
-              remainingPackets = payload.at(payload.size() - remainingPackets);
-              if (remainingPackets == 0) break;
-            }
-          } else if (remainingPacketsByte < (signed)payload.size()) {
-            remainingPackets = payload.at(remainingPacketsByte);
-            if (remainingPackets == 0) break;
-          }
-        }
-        responsesGuard.unlock();
+      std::shared_lock<std::shared_mutex> commandCountersGuard(_commandCountersMutex);
+      for (auto &commandCounters: _commandCounters) {
+        std::string command = "0x" + BaseLib::HelperFunctions::getHexString((int32_t)commandCounters.first, 4);
+        uint64_t received = commandCounters.second->received;
+        uint64_t sent = commandCounters.second->sent;
+        if (received > 0) framesReceivedByCommand->structValue->emplace(command, std::make_shared<BaseLib::Variable>((int64_t)received));
+        if (sent > 0) framesSentByCommand->structValue->emplace(command, std::make_shared<BaseLib::Variable>((int64_t)sent));
       }
+    }
+    metrics->structValue->emplace("framesReceivedByCommand", framesReceivedByCommand);
+    metrics->structValue->emplace("framesSentByCommand", framesSentByCommand);
 
-      if (remainingPackets != 0) {
-        _out.printWarning("Warning: Not all response packets (" + std::to_string(remainingPackets) + " still missing) have been received before timeout for request: " + BaseLib::HelperFunctions::getHexString(slipPacket));
-      }
+    return metrics;
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Variable::createError(-32500, "Unknown application error.");
+}
 
-      responsesGuard.lock();
-      returnValue.second = _responseCollections[notificationCommand];
-      _responseCollections.erase(notificationCommand);
-      responsesGuard.unlock();
+Klf200::CommandLatency *Klf200::getLatency(VeluxCommand requestCommand) {
+  auto latencyIterator = _latencies.find(requestCommand);
+  if (latencyIterator == _latencies.end()) return nullptr;
+  return latencyIterator->second.get();
+}
+
+void Klf200::addPendingSession(const PVeluxPacket &requestPacket, int64_t requestTime, const std::shared_ptr<Request> &request) {
+  try {
+    auto command = requestPacket->getCommand();
+    //All of these requests start with the session ID.
+    if (command != VeluxCommand::GW_COMMAND_SEND_REQ && command != VeluxCommand::GW_STATUS_REQUEST_REQ && command != VeluxCommand::GW_WINK_SEND_REQ &&
+        command != VeluxCommand::GW_SET_LIMITATION_REQ && command != VeluxCommand::GW_GET_LIMITATION_STATUS_REQ && command != VeluxCommand::GW_MODE_SEND_REQ &&
+        command != VeluxCommand::GW_ACTIVATE_SCENE_REQ && command != VeluxCommand::GW_STOP_SCENE_REQ && command != VeluxCommand::GW_ACTIVATE_PRODUCTGROUP_REQ) {
+      return;
     }
+    auto &payload = requestPacket->getPayload();
+    if (payload.size() < 2) return;
+    uint16_t sessionId = (((uint16_t)payload[0]) << 8) | payload[1];
+
+    std::lock_guard<std::mutex> pendingSessionsGuard(_pendingSessionsMutex);
+    //Sessions the gateway never finished (e.g. because the request was rejected) are removed after 10 minutes.
+    for (auto pendingSessionIterator = _pendingSessions.begin(); pendingSessionIterator != _pendingSessions.end();) {
+      if (requestTime - pendingSessionIterator->second.requestTime > 600000000) pendingSessionIterator = _pendingSessions.erase(pendingSessionIterator);
+      else pendingSessionIterator++;
+    }
+    auto &pendingSession = _pendingSessions[sessionId];
+    pendingSession.command = command;
+    pendingSession.requestTime = requestTime;
+    pendingSession.request = request;
+    pendingSession.notificationReceived = false;
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
 
-    return returnValue;
+void Klf200::removePendingSession(const PVeluxPacket &requestPacket) {
+  try {
+    auto &payload = requestPacket->getPayload();
+    if (payload.size() < 2) return;
+    uint16_t sessionId = (((uint16_t)payload[0]) << 8) | payload[1];
+    std::lock_guard<std::mutex> pendingSessionsGuard(_pendingSessionsMutex);
+    auto pendingSessionIterator = _pendingSessions.find(sessionId);
+    if (pendingSessionIterator != _pendingSessions.end() && pendingSessionIterator->second.command == requestPacket->getCommand()) _pendingSessions.erase(pendingSessionIterator);
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  return std::pair<PVeluxPacket, std::list<PVeluxPacket>>();
+}
+
+void Klf200::processSessionNotification(const PVeluxPacket &packet, int64_t receiveTime) {
+  try {
+    auto command = packet->getCommand();
+    //All of these notifications start with the session ID.
+    if (command != VeluxCommand::GW_COMMAND_RUN_STATUS_NTF && command != VeluxCommand::GW_COMMAND_REMAINING_TIME_NTF && command != VeluxCommand::GW_SESSION_FINISHED_NTF &&
+        command != VeluxCommand::GW_STATUS_REQUEST_NTF && command != VeluxCommand::GW_WINK_SEND_NTF && command != VeluxCommand::GW_LIMITATION_STATUS_NTF) {
+      return;
+    }
+    auto &payload = packet->getPayload();
+    if (payload.size() < 2) return;
+    uint16_t sessionId = (((uint16_t)payload[0]) << 8) | payload[1];
+
+    std::lock_guard<std::mutex> pendingSessionsGuard(_pendingSessionsMutex);
+    auto pendingSessionIterator = _pendingSessions.find(sessionId);
+    if (pendingSessionIterator == _pendingSessions.end()) return;
+    auto &pendingSession = pendingSessionIterator->second;
+    auto latency = getLatency(pendingSession.command);
+    if (!latency) return;
+
+    //The confirmation is processed on this thread as well, so "responseTime" is already set.
+    if (!pendingSession.notificationReceived && pendingSession.request->responseTime != 0) {
+      pendingSession.notificationReceived = true;
+      latency->confirmationToFirstNotification.record(receiveTime - pendingSession.request->responseTime);
+    }
+    if (command == VeluxCommand::GW_SESSION_FINISHED_NTF) {
+      latency->requestToFinished.record(receiveTime - pendingSession.requestTime);
+      _pendingSessions.erase(pendingSessionIterator);
+    }
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+PVariable Klf200::getLatencyStatistics() {
+  try {
+    auto result = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tStruct);
+    for (auto &latency: _latencies) {
+      std::array<std::pair<const char *, LatencyHistogram *>, 3> histograms{
+          std::make_pair("requestToConfirmation", &latency.second->requestToConfirmation),
+          std::make_pair("confirmationToFirstNotification", &latency.second->confirmationToFirstNotification),
+          std::make_pair("requestToFinished", &latency.second->requestToFinished)
+      };
+
+      auto commandStruct = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tStruct);
+      for (auto &histogram: histograms) {
+        auto snapshot = histogram.second->getSnapshot();
+        if (snapshot.count == 0) continue;
+        auto histogramStruct = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tStruct);
+        histogramStruct->structValue->emplace("count", std::make_shared<BaseLib::Variable>((int64_t)snapshot.count));
+        histogramStruct->structValue->emplace("mean", std::make_shared<BaseLib::Variable>(snapshot.getMean()));
+        histogramStruct->structValue->emplace("p50", std::make_shared<BaseLib::Variable>(snapshot.getPercentile(50)));
+        histogramStruct->structValue->emplace("p90", std::make_shared<BaseLib::Variable>(snapshot.getPercentile(90)));
+        histogramStruct->structValue->emplace("p99", std::make_shared<BaseLib::Variable>(snapshot.getPercentile(99)));
+        histogramStruct->structValue->emplace("max", std::make_shared<BaseLib::Variable>(snapshot.max));
+        commandStruct->structValue->emplace(histogram.first, histogramStruct);
+      }
+      if (commandStruct->structValue->empty()) continue;
+      result->structValue->emplace("0x" + BaseLib::HelperFunctions::getHexString((int32_t)latency.first, 4), commandStruct);
+    }
+    return result;
+  }
+  catch (const std::exception &ex) {
+    _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Variable::createError(-32500, "Unknown application error.");
+}
+
+void Klf200::resetLatencyStatistics() {
+  for (auto &latency: _latencies) {
+    latency.second->requestToConfirmation.reset();
+    latency.second->confirmationToFirstNotification.reset();
+    latency.second->requestToFinished.reset();
+  }
 }
 
 std::list<PVeluxPacket> Klf200::getNodeInfo() {
+  return getNodeInfoAsync().get();
+}
+
+Task<std::list<PVeluxPacket>> Klf200::getNodeInfoAsync() {
   try {
     std::vector<uint8_t> payload;
     auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_GET_ALL_NODES_INFORMATION_REQ, payload);
-    auto result = getMultipleResponses(VeluxCommand::GW_GET_ALL_NODES_INFORMATION_CFM, VeluxCommand::GW_GET_ALL_NODES_INFORMATION_NTF, VeluxCommand::GW_GET_ALL_NODES_INFORMATION_FINISHED_NTF, veluxPacket);
+    auto result = co_await getMultipleResponsesAsync(VeluxCommand::GW_GET_ALL_NODES_INFORMATION_CFM, VeluxCommand::GW_GET_ALL_NODES_INFORMATION_NTF, VeluxCommand::GW_GET_ALL_NODES_INFORMATION_FINISHED_NTF, veluxPacket);
     if (!result.first || result.first->getPayload().size() < 2) {
       _out.printError("Error: Could get nodes from KLF200.");
       _stopped = true;
-      return std::list<PVeluxPacket>();
+      co_return std::list<PVeluxPacket>();
     }
 
     payload = result.first->getPayload();
@@ -627,34 +1036,39 @@ std::list<PVeluxPacket> Klf200::getNodeInfo() {
 
     if (result.second.size() != nodeCount) _out.printWarning("Warning: Expected to receive information for " + std::to_string(nodeCount) + " nodes, but only received information for " + std::to_string(result.second.size()) + " nodes.");
 
-    return result.second;
+    co_return result.second;
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  return std::list<PVeluxPacket>();
+  co_return std::list<PVeluxPacket>();
 }
 
 std::list<PVeluxPacket> Klf200::getSceneInfo() {
+  return getSceneInfoAsync().get();
+}
+
+Task<std::list<PVeluxPacket>> Klf200::getSceneInfoAsync() {
   try {
     std::vector<uint8_t> payload;
     auto veluxPacket = std::make_shared<VeluxPacket>(VeluxCommand::GW_GET_SCENE_LIST_REQ, payload);
-    auto result = getMultipleResponses(VeluxCommand::GW_GET_SCENE_LIST_CFM, VeluxCommand::GW_GET_SCENE_LIST_NTF, -1, veluxPacket);
-    if (!result.first || result.first->getPayload().size() < 2) {
+    auto result = co_await getMultipleResponsesAsync(VeluxCommand::GW_GET_SCENE_LIST_CFM, VeluxCommand::GW_GET_SCENE_LIST_NTF, -1, 0, veluxPacket);
+    if (!result.first || result.first->getPayload().empty()) {
       _out.printError("Error: Could get scenes from KLF200.");
       _stopped = true;
-      return std::list<PVeluxPacket>();
+      co_return std::list<PVeluxPacket>();
     }
 
-    payload = result.first->getPayload();
-    auto sceneCount = payload.at(0);
+    //GW_GET_SCENE_LIST_CFM only contains the total number of scenes
+    auto sceneCount = result.first->getPayload().at(0);
+    _out.printDebug("Debug: KLF200 has " + std::to_string(sceneCount) + " scenes.");
 
-    return result.second;
+    co_return result.second;
   }
   catch (const std::exception &ex) {
     _out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  return std::list<PVeluxPacket>();
+  co_return std::list<PVeluxPacket>();
 }
 
 }
@@ -30,9 +30,22 @@
 #ifndef KLF200_H
 #define KLF200_H
 
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <optional>
+#include <shared_mutex>
 
 #include "../VeluxPacket.h"
+#include "AsyncMutex.h"
+#include "LatencyHistogram.h"
+#include "PacketCapture.h"
+#include "PacketTrace.h"
+#include "Reactor.h"
+#include "Slip.h"
+#include "Task.h"
+#include "Transport.h"
+#include "WriterPool.h"
 
 namespace Velux
 {
@@ -40,51 +53,380 @@ namespace Velux
 class Klf200 : public BaseLib::Systems::IPhysicalInterface
 {
 public:
+    struct ReplayResult
+    {
+        size_t records = 0;
+        size_t frames = 0;
+        size_t bytes = 0;
+        //In nanoseconds
+        int64_t duration = 0;
+    };
+
+    /**
+     * Round trip latencies of one request command.
+     */
+    struct CommandLatency
+    {
+        LatencyHistogram requestToConfirmation;
+        //First notification belonging to the request (same session or requested list)
+        LatencyHistogram confirmationToFirstNotification;
+        //GW_SESSION_FINISHED_NTF or the "finished" notification of a requested list
+        LatencyHistogram requestToFinished;
+    };
+
     explicit Klf200(std::shared_ptr<BaseLib::Systems::PhysicalInterfaceSettings> settings);
     ~Klf200() override;
     void startListening() override;
     void stopListening() override;
     void sendPacket(std::shared_ptr<BaseLib::Systems::Packet> packet) override;
+
+    /**
+     * Sends "packet" and waits for its confirmation. Must not be called on the reactor thread.
+     *
+     * @return Returns the confirmation or nullptr when none was received.
+     */
+    PVeluxPacket sendRequest(const PVeluxPacket& packet);
     bool isOpen() override { return !_stopped; }
+
+    /**
+     * Uses "transport" instead of connecting to the configured host. Needs to be called before startListening(). This
+     * is used to run the interface on an in-process loopback (see LoopbackTransport).
+     */
+    void setTransport(std::shared_ptr<Transport> transport) { _customTransport = std::move(transport); }
     std::list<PVeluxPacket> getNodeInfo();
     std::list<PVeluxPacket> getSceneInfo();
+
+    /**
+     * Requests the node information without blocking a thread. The coroutine is resumed on the reactor thread.
+     */
+    Task<std::list<PVeluxPacket>> getNodeInfoAsync();
+
+    /**
+     * Requests the scene list without blocking a thread. The coroutine is resumed on the reactor thread.
+     */
+    Task<std::list<PVeluxPacket>> getSceneInfoAsync();
     uint16_t getMessageCounter();
+    int32_t getEventThrottleInterval() { return _eventThrottleInterval; }
+    std::vector<PacketTrace::Entry> getPacketTrace(size_t count = 0) { return _packetTrace->getEntries(count); }
+
+    /**
+     * Returns the count, mean, percentiles and maximum (all in microseconds) of the round trip latencies of all
+     * request commands sent since the last reset.
+     */
+    PVariable getLatencyStatistics();
+    void resetLatencyStatistics();
+
+    /**
+     * Returns the counters of this interface (bytes and frames in both directions, invalid frames, timeouts,
+     * reconnects) and the current queue depths.
+     */
+    PVariable getMetrics();
+
+    /**
+     * Starts writing the raw byte stream of this interface into "filename".
+     */
+    bool startCapture(const std::string& filename) { return _packetCapture.open(filename); }
+    void stopCapture() { _packetCapture.close(); }
+    bool isCapturing() { return _packetCapture.isOpen(); }
+
+    /**
+     * Returns "true" for interfaces of type "klf200-replay". They never connect to a gateway and are only used to replay
+     * captures.
+     */
+    bool isReplayInterface() { return _replayInterface; }
+    bool isReplaying() { return _replaying; }
+
+    /**
+     * Feeds the received data of a capture file through the receive path of this interface (processPacket()) as if
+     * it came from the gateway. Runs on the calling thread and as fast as possible.
+     *
+     * Replays only run on replay interfaces (see isReplayInterface()). Otherwise replayed confirmations would complete
+     * requests of the real gateway and replayed frames would be mixed with real ones.
+     *
+     * @param filename The capture file.
+     * @param[out] result Statistics of the replay.
+     * @return Returns "false" when this is no replay interface, another replay is running or the capture file could not
+     * be read.
+     */
+    bool replay(const std::string& filename, ReplayResult& result);
+
+    /**
+     * Same as replay(), but reproduces the original timing of the capture on a separate thread. The statistics are
+     * written to the log when the replay is finished.
+     */
+    bool startReplay(const std::string& filename);
 protected:
     struct Request
     {
         std::mutex mutex;
-        std::condition_variable conditionVariable;
-        bool mutexReady = false;
+        //Set by completeRequest() on response, timeout or disconnect
+        bool completed = false;
+        //The coroutine waiting for the response
+        std::coroutine_handle<> waiter;
+        uint64_t timeoutTimer = 0;
+        //Empty on timeout or disconnect
         PVeluxPacket response;
+        //Time the response was received (see LatencyHistogram::getTime())
+        int64_t responseTime = 0;
+    };
+
+    /**
+     * Notifications collected for a request returning a list.
+     */
+    struct ResponseCollection
+    {
+        std::list<PVeluxPacket> packets;
+        int64_t firstPacketTime = 0;
+        //Byte of the notifications containing the number of remaining notifications. Negative values count from the end
+        //of the payload. Only set when the list has no "finished" notification.
+        std::optional<int32_t> remainingPacketsByte;
+        //Completed by the "finished" notification or by the last notification
+        std::shared_ptr<Request> finishedRequest;
+    };
+
+    /**
+     * Suspends the awaiting coroutine until the request is completed by its response, by a timeout or by
+     * cancelRequests().
+     */
+    class ResponseAwaiter
+    {
+    public:
+        ResponseAwaiter(Klf200& interface, std::shared_ptr<Request> request, int32_t timeout) : _interface(interface), _request(std::move(request)), _timeout(timeout) {}
+
+        bool await_ready();
+        bool await_suspend(std::coroutine_handle<> handle);
+        void await_resume() {}
+    private:
+        Klf200& _interface;
+        std::shared_ptr<Request> _request;
+        //In milliseconds
+        int32_t _timeout = 0;
+    };
+
+    /**
+     * A sent request with a session ID that is still waiting for GW_SESSION_FINISHED_NTF.
+     */
+    struct PendingSession
+    {
+        VeluxCommand command = VeluxCommand::UNSET;
+        int64_t requestTime = 0;
+        std::shared_ptr<Request> request;
+        bool notificationReceived = false;
     };
 
     BaseLib::Output _out;
     int32_t _port = 51200;
-    std::shared_ptr<C1Net::TcpSocket> _tcpSocket;
+    //"false" for interface type "klf200-tcp"
+    bool _tls = true;
+    int32_t _eventThrottleInterval = 1000;
+    std::shared_ptr<Transport> _customTransport;
+    std::shared_ptr<Transport> _transport;
+
+    //{{{ Reactor
+    std::shared_ptr<Reactor> _reactor;
+    std::atomic<uint64_t> _readRegistration{0};
+    std::atomic<uint64_t> _heartbeatTimer{0};
+    std::atomic<uint64_t> _reconnectTimer{0};
+    //Set while a heartbeat request is waiting for its response
+    std::atomic_bool _heartbeatRunning{false};
+    //Only used on the reactor thread
+    std::vector<uint8_t> _readBuffer;
+    Slip _slip;
+    //}}}
+
+    //{{{ Sending
+    //Sending may block, so packets are written to the transport by a job on "_writerPool" and never on the reactor
+    //thread. The variables below are protected by "_sendQueueMutex".
+    std::shared_ptr<WriterPool> _writerPool;
+    std::mutex _sendQueueMutex;
+    //Notified when flushSendQueue() returns
+    std::condition_variable _sendQueueConditionVariable;
+    std::deque<std::vector<uint8_t>> _sendQueue;
+    //Set while a flushSendQueue() job is posted or running. There is at most one per interface, so frames are sent in
+    //order.
+    bool _sendScheduled = false;
+    bool _stopSending = false;
+    //}}}
 
     std::atomic<uint16_t> _messageCounter{ 0 };
 
+    //{{{ Metrics
+    struct CommandCounters
+    {
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> sent{0};
+    };
+
+    std::atomic<uint64_t> _bytesReceived{0};
+    std::atomic<uint64_t> _bytesSent{0};
+    std::atomic<uint64_t> _framesReceived{0};
+    std::atomic<uint64_t> _framesSent{0};
+    std::atomic<uint64_t> _lengthErrors{0};
+    std::atomic<uint64_t> _checksumErrors{0};
+    std::atomic<uint64_t> _otherFrameErrors{0};
+    std::atomic<uint64_t> _timeouts{0};
+    std::atomic<uint64_t> _reconnects{0};
+    //Entries are only added, never removed. The counters are incremented while holding the shared lock.
+    std::shared_mutex _commandCountersMutex;
+    std::unordered_map<uint16_t, std::unique_ptr<CommandCounters>> _commandCounters;
+    //}}}
+
+    std::unique_ptr<PacketTrace> _packetTrace;
+    PacketCapture _packetCapture;
+
+    //Opens the connection. Only exists while connecting.
     std::thread _initThread;
-    std::thread _heartbeatThread;
 
-    int64_t _lastHeartBeat;
+    //{{{ Replay
+    //Interface type "klf200-replay"
+    bool _replayInterface = false;
+    std::atomic_bool _replaying{false};
+    std::atomic_bool _stopReplay{false};
+    std::thread _replayThread;
+    //}}}
 
-    std::mutex _sendPacketMutex;
-    std::mutex _getResponseMutex;
+    //Only one request is sent at a time.
+    AsyncMutex _requestMutex;
     std::mutex _responsesMutex;
     std::unordered_map<VeluxCommand, std::shared_ptr<Request>> _responses;
-    std::unordered_map<VeluxCommand, std::list<PVeluxPacket>> _responseCollections;
+    std::unordered_map<VeluxCommand, std::shared_ptr<ResponseCollection>> _responseCollections;
+
+    //The key is the request command. The map is filled in the constructor and not changed afterwards, so it is read
+    //without locking.
+    std::unordered_map<VeluxCommand, std::unique_ptr<CommandLatency>> _latencies;
+    std::mutex _pendingSessionsMutex;
+    std::unordered_map<uint16_t, PendingSession> _pendingSessions;
+
+
+    /**
+     * Opens the transport, registers it in the reactor and starts the initialization of the gateway. Runs in
+     * "_initThread".
+     *
+     * @param reconnect Set to "true" when the connection was lost before.
+     */
+    void connect(bool reconnect);
+
+    /**
+     * Removes the transport from the reactor and closes it.
+     *
+     * @return Returns "false" when the transport was not registered.
+     */
+    bool disconnect();
+
+    /**
+     * Disconnects and schedules a reconnect. Does nothing when already disconnected.
+     */
+    void connectionLost();
+    void scheduleReconnect();
+    void scheduleHeartbeat();
+
+    /**
+     * Called by the reactor when the transport is readable. Reads all available data and processes complete frames.
+     */
+    void readTransport();
 
+    /**
+     * Logs in and sets up the gateway.
+     *
+     * @return Returns "false" when the gateway needs to be reconnected.
+     */
+    Task<bool> initAsync();
 
-    void listen();
-    void init();
+    /**
+     * Sends a heartbeat unless the previous one is still running. Called by the heartbeat timer.
+     */
     void heartbeat();
 
-    std::vector<uint8_t> slipEncode(const std::vector<uint8_t>& data);
-    void processPacket(std::vector<uint8_t>& data);
+    /**
+     * Reads the capture file and reserves the interface for the replay.
+     */
+    bool prepareReplay(const std::string& filename, std::vector<PacketCapture::Record>& records);
+    void replayRecords(const std::vector<PacketCapture::Record>& records, bool originalPace, ReplayResult& result);
+    void replayThread(std::vector<PacketCapture::Record> records);
+
+    /**
+     * Stops a replay running on "_replayThread" and waits for it to finish.
+     */
+    void stopReplay();
+
+    /**
+     * @param readTime The time the data was read from the transport or "0" when stage tracing is disabled.
+     */
+    void processPacket(std::vector<uint8_t>& data, int64_t readTime = 0);
+    CommandCounters& getCommandCounters(VeluxCommand command);
+
+    /**
+     * Queues "slipPacket" for "_writerPool" and updates the trace and the counters. Doesn't block, so it can be called
+     * on the reactor thread. When sending fails, the connection is reconnected, which cancels all pending requests.
+     */
+    void send(VeluxCommand command, const std::vector<uint8_t>& requestBinary, const std::vector<uint8_t>& slipPacket);
+
+    /**
+     * Writes queued packets to the transport until the queue is empty. Runs on "_writerPool".
+     */
+    void flushSendQueue();
+
+    /**
+     * Drops queued packets, waits for a running flushSendQueue() and releases "_writerPool".
+     */
+    void stopSending();
+    CommandLatency* getLatency(VeluxCommand requestCommand);
+
+    /**
+     * Starts tracking the session of "requestPacket" if it is a session based request.
+     */
+    void addPendingSession(const PVeluxPacket& requestPacket, int64_t requestTime, const std::shared_ptr<Request>& request);
+    void removePendingSession(const PVeluxPacket& requestPacket);
+
+    /**
+     * Records the latencies of a notification belonging to a pending session.
+     */
+    void processSessionNotification(const PVeluxPacket& packet, int64_t receiveTime);
+
+    /**
+     * Completes "request" and resumes the coroutine waiting for it. Does nothing when the request is completed
+     * already.
+     *
+     * @param response The response or "nullptr" on timeout.
+     */
+    void completeRequest(const std::shared_ptr<Request>& request, const PVeluxPacket& response, int64_t responseTime);
+
+    /**
+     * Completes all pending requests without a response. Called when the connection is closed.
+     */
+    void cancelRequests();
+    void removeResponse(VeluxCommand responseCommand, const std::shared_ptr<Request>& request);
+
+    /**
+     * Blocking version of getResponseAsync(). Must not be called on the reactor thread.
+     */
     PVeluxPacket getResponse(VeluxCommand responseCommand, const PVeluxPacket& requestPacket, int32_t waitForSeconds = 15);
-    std::pair<PVeluxPacket, std::list<PVeluxPacket>> getMultipleResponses(VeluxCommand responseCommand, VeluxCommand notificationCommand, VeluxCommand finishedCommand, const PVeluxPacket& requestPacket, int32_t waitForSeconds = 15);
-    std::pair<PVeluxPacket, std::list<PVeluxPacket>> getMultipleResponses(VeluxCommand responseCommand, VeluxCommand notificationCommand, int32_t remainingPacketsByte, const PVeluxPacket& requestPacket, int32_t waitForSeconds = 15);
+
+    /**
+     * Sends "requestPacket" and waits for the response without blocking the thread. Requests are sent one after
+     * another.
+     *
+     * @return Returns the response or "nullptr" on error or timeout.
+     */
+    Task<PVeluxPacket> getResponseAsync(VeluxCommand responseCommand, PVeluxPacket requestPacket, int32_t waitForSeconds = 15);
+
+    /**
+     * Sends "requestPacket" and collects all "notificationCommand" packets until "finishedCommand" is received.
+     *
+     * @return Returns the confirmation and the collected notifications.
+     */
+    Task<std::pair<PVeluxPacket, std::list<PVeluxPacket>>> getMultipleResponsesAsync(VeluxCommand responseCommand, VeluxCommand notificationCommand, VeluxCommand finishedCommand, PVeluxPacket requestPacket, int32_t waitForSeconds = 15);
+
+    /**
+     * Sends "requestPacket" and collects all "notificationCommand" packets until the byte "remainingPacketsByte" of a
+     * notification is "0". Negative values of "remainingPacketsByte" count from the end of the payload.
+     *
+     * @param countByte Byte of the confirmation containing the number of list entries. When it is "0", no notification
+     * is sent and the method returns right after the confirmation.
+     * @return Returns the confirmation and the collected notifications.
+     */
+    Task<std::pair<PVeluxPacket, std::list<PVeluxPacket>>> getMultipleResponsesAsync(VeluxCommand responseCommand, VeluxCommand notificationCommand, int32_t remainingPacketsByte, std::optional<int32_t> countByte, PVeluxPacket requestPacket, int32_t waitForSeconds = 15);
+    Task<std::pair<PVeluxPacket, std::list<PVeluxPacket>>> collectResponsesAsync(VeluxCommand responseCommand, VeluxCommand notificationCommand, VeluxCommand finishedCommand, std::optional<int32_t> remainingPacketsByte, std::optional<int32_t> countByte, PVeluxPacket requestPacket, int32_t waitForSeconds);
 };
 
 }
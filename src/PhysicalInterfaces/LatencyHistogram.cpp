@@ -0,0 +1,103 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace Velux {
+
+LatencyHistogram::LatencyHistogram() {
+  for (auto &bucket: _buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+int64_t LatencyHistogram::getTime() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t LatencyHistogram::getBucketIndex(uint64_t value) {
+  //The first 8 buckets are exact. After that each power of two is split into 8 buckets.
+  if (value < 8) return value;
+  size_t exponent = 63 - __builtin_clzll(value);
+  size_t index = (exponent - 2) * 8 + ((value >> (exponent - 3)) & 7);
+  return index < bucketCount ? index : bucketCount - 1;
+}
+
+int64_t LatencyHistogram::getBucketUpperBound(size_t index) {
+  if (index < 8) return index;
+  size_t shift = index / 8 - 1;
+  return ((int64_t)(8 + (index & 7)) << shift) + ((int64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(int64_t microseconds) {
+  if (microseconds < 0) microseconds = 0;
+  _buckets[getBucketIndex((uint64_t)microseconds)].fetch_add(1, std::memory_order_relaxed);
+  _sum.fetch_add(microseconds, std::memory_order_relaxed);
+  int64_t max = _max.load(std::memory_order_relaxed);
+  while (microseconds > max && !_max.compare_exchange_weak(max, microseconds, std::memory_order_relaxed));
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::getSnapshot() const {
+  //The fields are read one by one, so a snapshot taken while values are recorded might be off by a few values.
+  Snapshot snapshot;
+  for (size_t i = 0; i < bucketCount; i++) {
+    snapshot.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+    snapshot.count += snapshot.buckets[i];
+  }
+  snapshot.sum = _sum.load(std::memory_order_relaxed);
+  snapshot.max = _max.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+void LatencyHistogram::reset() {
+  for (auto &bucket: _buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  _sum.store(0, std::memory_order_relaxed);
+  _max.store(0, std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::Snapshot::getPercentile(double percentile) const {
+  if (count == 0) return 0;
+  uint64_t target = (uint64_t)std::ceil(percentile / 100.0 * count);
+  if (target == 0) target = 1;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < bucketCount; i++) {
+    sum += buckets[i];
+    if (sum >= target) return std::min(getBucketUpperBound(i), max);
+  }
+  return max;
+}
+
+}
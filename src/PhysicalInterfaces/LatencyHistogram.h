@@ -0,0 +1,89 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Velux
+{
+
+/**
+ * Histogram of latencies in microseconds with fixed log-linear buckets (8 buckets per power of two, so the relative
+ * error is below 12.5 %). Recording a value only increments atomics and never locks or allocates.
+ */
+class LatencyHistogram
+{
+public:
+    //Values up to 2^31 µs (about 35 minutes). Larger values are counted in the last bucket.
+    static constexpr size_t bucketCount = 232;
+
+    struct Snapshot
+    {
+        uint64_t count = 0;
+        int64_t sum = 0;
+        int64_t max = 0;
+        std::array<uint64_t, bucketCount> buckets{};
+
+        double getMean() const { return count == 0 ? 0 : (double)sum / count; }
+
+        /**
+         * Returns the upper bound of the bucket containing the given percentile.
+         *
+         * @param percentile The percentile between 0 and 100.
+         */
+        int64_t getPercentile(double percentile) const;
+    };
+
+    LatencyHistogram();
+
+    /**
+     * Returns the current time of the monotonic clock in microseconds.
+     */
+    static int64_t getTime();
+
+    void record(int64_t microseconds);
+    Snapshot getSnapshot() const;
+    void reset();
+private:
+    std::array<std::atomic<uint64_t>, bucketCount> _buckets;
+    std::atomic<int64_t> _sum{0};
+    std::atomic<int64_t> _max{0};
+
+    static size_t getBucketIndex(uint64_t value);
+    static int64_t getBucketUpperBound(size_t index);
+};
+
+}
+#endif
@@ -0,0 +1,124 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "LoopbackTransport.h"
+
+#include <homegear-base/BaseLib.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace Velux {
+
+LoopbackTransport::Channel::Channel() {
+  eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+LoopbackTransport::Channel::~Channel() {
+  if (eventFd != -1) ::close(eventFd);
+}
+
+void LoopbackTransport::Channel::signal() {
+  uint64_t value = 1;
+  if (::write(eventFd, &value, sizeof(value)) != sizeof(value)) {
+    //Only fails when the counter overflows, which keeps the file descriptor readable anyway.
+  }
+}
+
+void LoopbackTransport::Channel::resetSignal() {
+  uint64_t value = 0;
+  if (::read(eventFd, &value, sizeof(value)) != sizeof(value)) {
+    //The counter already was 0.
+  }
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<Connection> connection, size_t inputIndex, uint32_t readTimeout)
+    : _connection(std::move(connection)), _input(_connection->channels[inputIndex]), _output(_connection->channels[inputIndex ^ 1]), _readTimeout(readTimeout) {
+}
+
+std::pair<std::shared_ptr<LoopbackTransport>, std::shared_ptr<LoopbackTransport>> LoopbackTransport::createPair(uint32_t readTimeout) {
+  auto connection = std::make_shared<Connection>();
+  //The constructor is private, so std::make_shared can't be used.
+  std::shared_ptr<LoopbackTransport> first(new LoopbackTransport(connection, 0, readTimeout));
+  std::shared_ptr<LoopbackTransport> second(new LoopbackTransport(connection, 1, readTimeout));
+  return std::make_pair(first, second);
+}
+
+void LoopbackTransport::open() {
+  if (_connection->open) return;
+  for (auto &channel: _connection->channels) {
+    std::lock_guard<std::mutex> channelGuard(channel.mutex);
+    channel.data.clear();
+    channel.readPosition = 0;
+    channel.resetSignal();
+  }
+  _connection->open = true;
+}
+
+void LoopbackTransport::close() {
+  _connection->open = false;
+  for (auto &channel: _connection->channels) {
+    //Lock to not miss a reader that is about to wait
+    std::lock_guard<std::mutex> channelGuard(channel.mutex);
+    channel.signal();
+    channel.conditionVariable.notify_all();
+  }
+}
+
+size_t LoopbackTransport::read(uint8_t *buffer, size_t size) {
+  std::unique_lock<std::mutex> channelGuard(_input.mutex);
+  if (!_input.conditionVariable.wait_for(channelGuard, std::chrono::milliseconds(_readTimeout), [&] { return !_connection->open || _input.readPosition < _input.data.size(); })) {
+    throw C1Net::TimeoutException("Reading from loopback timed out.");
+  }
+  if (!_connection->open) throw C1Net::ClosedException("Loopback is closed.");
+
+  size_t bytesRead = std::min(size, _input.data.size() - _input.readPosition);
+  std::copy_n(_input.data.begin() + _input.readPosition, bytesRead, buffer);
+  _input.readPosition += bytesRead;
+  if (_input.readPosition == _input.data.size()) {
+    //Keeps the capacity, so the buffer is reused.
+    _input.data.clear();
+    _input.readPosition = 0;
+    _input.resetSignal();
+  }
+  return bytesRead;
+}
+
+void LoopbackTransport::send(const std::vector<uint8_t> &data) {
+  if (!_connection->open) throw C1Net::ClosedException("Loopback is closed.");
+  {
+    std::lock_guard<std::mutex> channelGuard(_output.mutex);
+    _output.data.insert(_output.data.end(), data.begin(), data.end());
+    _output.signal();
+  }
+  _output.conditionVariable.notify_one();
+}
+
+}
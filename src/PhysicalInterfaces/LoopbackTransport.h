@@ -0,0 +1,97 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef LOOPBACKTRANSPORT_H
+#define LOOPBACKTRANSPORT_H
+
+#include "Transport.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+namespace Velux
+{
+
+/**
+ * In-process connection between two endpoints created by createPair(). Bytes sent on one endpoint are read on the
+ * other one. This allows driving Klf200 with a simulated gateway at memory speed without any socket.
+ */
+class LoopbackTransport : public Transport
+{
+public:
+    /**
+     * Creates two connected endpoints. The first one is usually passed to Klf200, the second one plays the gateway.
+     *
+     * @param readTimeout Time in milliseconds read() waits for data before throwing C1Net::TimeoutException.
+     */
+    static std::pair<std::shared_ptr<LoopbackTransport>, std::shared_ptr<LoopbackTransport>> createPair(uint32_t readTimeout = 5000);
+
+    ~LoopbackTransport() override = default;
+
+    void open() override;
+    void close() override;
+    bool isConnected() override { return _connection->open; }
+    int32_t getFileDescriptor() override { return _input.eventFd; }
+    size_t read(uint8_t* buffer, size_t size) override;
+    void send(const std::vector<uint8_t>& data) override;
+private:
+    struct Channel
+    {
+        std::mutex mutex;
+        std::condition_variable conditionVariable;
+        std::vector<uint8_t> data;
+        size_t readPosition = 0;
+        //Readable while there is unread data or the connection is closed
+        int32_t eventFd = -1;
+
+        Channel();
+        ~Channel();
+        void signal();
+        void resetSignal();
+    };
+
+    struct Connection
+    {
+        std::atomic_bool open{true};
+        Channel channels[2];
+    };
+
+    std::shared_ptr<Connection> _connection;
+    Channel& _input;
+    Channel& _output;
+    uint32_t _readTimeout = 5000;
+
+    LoopbackTransport(std::shared_ptr<Connection> connection, size_t inputIndex, uint32_t readTimeout);
+};
+
+}
+#endif
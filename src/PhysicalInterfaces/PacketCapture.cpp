@@ -0,0 +1,104 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "PacketCapture.h"
+
+#include <algorithm>
+
+namespace Velux {
+
+PacketCapture::~PacketCapture() {
+  close();
+}
+
+bool PacketCapture::open(const std::string &filename) {
+  std::lock_guard<std::mutex> fileGuard(_fileMutex);
+  _open = false;
+  if (_file.is_open()) _file.close();
+  _file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!_file.is_open()) return false;
+  _file.write(_magic, sizeof(_magic));
+  _startTime = std::chrono::steady_clock::now();
+  _open = true;
+  return true;
+}
+
+void PacketCapture::close() {
+  std::lock_guard<std::mutex> fileGuard(_fileMutex);
+  _open = false;
+  if (_file.is_open()) _file.close();
+}
+
+void PacketCapture::write(PacketTrace::Direction direction, const uint8_t *data, size_t size) {
+  if (!_open) return;
+  std::lock_guard<std::mutex> fileGuard(_fileMutex);
+  if (!_file.is_open()) return;
+  uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _startTime).count();
+
+  uint8_t header[13];
+  for (int32_t i = 7; i >= 0; i--) {
+    header[i] = time & 0xFF;
+    time >>= 8;
+  }
+  header[8] = (uint8_t)direction;
+  header[9] = (size >> 24) & 0xFF;
+  header[10] = (size >> 16) & 0xFF;
+  header[11] = (size >> 8) & 0xFF;
+  header[12] = size & 0xFF;
+
+  _file.write((const char *)header, sizeof(header));
+  _file.write((const char *)data, size);
+}
+
+bool PacketCapture::read(const std::string &filename, std::vector<Record> &records) {
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  if (!file.is_open()) return false;
+
+  char magic[sizeof(_magic)];
+  if (!file.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), _magic)) return false;
+
+  uint8_t header[13];
+  while (file.read((char *)header, sizeof(header))) {
+    Record record;
+    uint64_t time = 0;
+    for (int32_t i = 0; i < 8; i++) {
+      time = (time << 8) | header[i];
+    }
+    record.time = (int64_t)time;
+    record.direction = (PacketTrace::Direction)header[8];
+    uint32_t size = (((uint32_t)header[9]) << 24) | (((uint32_t)header[10]) << 16) | (((uint32_t)header[11]) << 8) | header[12];
+    record.data.resize(size);
+    if (size > 0 && !file.read((char *)record.data.data(), size)) return false;
+    records.push_back(std::move(record));
+  }
+  return true;
+}
+
+}
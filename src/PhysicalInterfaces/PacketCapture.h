@@ -0,0 +1,94 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef PACKETCAPTURE_H
+#define PACKETCAPTURE_H
+
+#include "PacketTrace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Velux
+{
+
+/**
+ * Writes the raw (SLIP encoded) byte stream of a KLF200 connection into a capture file.
+ *
+ * File format: The 8 byte magic "VLXCAP01" followed by records. Each record consists of the time in nanoseconds since
+ * the capture was started (8 bytes, monotonic clock), the direction (1 byte, see PacketTrace::Direction), the data size
+ * (4 bytes) and the data. All numbers are big endian.
+ */
+class PacketCapture
+{
+public:
+    struct Record
+    {
+        int64_t time = 0;
+        PacketTrace::Direction direction = PacketTrace::Direction::received;
+        std::vector<uint8_t> data;
+    };
+
+    PacketCapture() = default;
+    ~PacketCapture();
+
+    bool isOpen() { return _open; }
+
+    /**
+     * Opens "filename" for writing. A capture that is already running is closed first.
+     *
+     * @return Returns "true" on success.
+     */
+    bool open(const std::string& filename);
+    void close();
+    void write(PacketTrace::Direction direction, const uint8_t* data, size_t size);
+
+    /**
+     * Reads all records of a capture file.
+     *
+     * @return Returns "false" when the file could not be opened or has an invalid format.
+     */
+    static bool read(const std::string& filename, std::vector<Record>& records);
+private:
+    static constexpr char _magic[8] = { 'V', 'L', 'X', 'C', 'A', 'P', '0', '1' };
+
+    std::atomic_bool _open{false};
+    std::mutex _fileMutex;
+    std::ofstream _file;
+    std::chrono::steady_clock::time_point _startTime;
+};
+
+}
+#endif
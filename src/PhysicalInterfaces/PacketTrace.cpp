@@ -0,0 +1,70 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "PacketTrace.h"
+
+#include <homegear-base/BaseLib.h>
+
+namespace Velux {
+
+PacketTrace::PacketTrace(size_t size) {
+  _entries.resize(size);
+  for (auto &entry: _entries) {
+    entry.data.reserve(_maxFrameSize);
+  }
+}
+
+void PacketTrace::add(Direction direction, const std::vector<uint8_t> &data) {
+  if (_entries.empty()) return;
+  int64_t time = BaseLib::HelperFunctions::getTime();
+  std::lock_guard<std::mutex> entriesGuard(_entriesMutex);
+  auto &entry = _entries[_nextIndex];
+  entry.time = time;
+  entry.direction = direction;
+  //Doesn't allocate as long as the frame fits into the reserved memory
+  entry.data.assign(data.begin(), data.end());
+  _nextIndex = (_nextIndex + 1) % _entries.size();
+  if (_count < _entries.size()) _count++;
+}
+
+std::vector<PacketTrace::Entry> PacketTrace::getEntries(size_t count) {
+  std::lock_guard<std::mutex> entriesGuard(_entriesMutex);
+  if (count == 0 || count > _count) count = _count;
+  std::vector<Entry> entries;
+  entries.reserve(count);
+  size_t index = (_nextIndex + _entries.size() - count) % (_entries.empty() ? 1 : _entries.size());
+  for (size_t i = 0; i < count; i++) {
+    entries.push_back(_entries[index]);
+    index = (index + 1) % _entries.size();
+  }
+  return entries;
+}
+
+}
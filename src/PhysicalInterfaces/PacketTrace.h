@@ -0,0 +1,86 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef PACKETTRACE_H
+#define PACKETTRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace Velux
+{
+
+/**
+ * Fixed size ring buffer of the raw frames sent to and received from a KLF200. Adding a frame only copies the bytes
+ * into preallocated memory. Formatting happens when the trace is read.
+ */
+class PacketTrace
+{
+public:
+    enum class Direction : uint8_t
+    {
+        received = 0,
+        sent = 1
+    };
+
+    struct Entry
+    {
+        int64_t time = 0;
+        Direction direction = Direction::received;
+        std::vector<uint8_t> data;
+    };
+
+    /**
+     * @param size The maximum number of frames to keep. "0" disables the trace.
+     */
+    explicit PacketTrace(size_t size);
+
+    void add(Direction direction, const std::vector<uint8_t>& data);
+
+    /**
+     * Returns the traced frames from oldest to newest.
+     *
+     * @param count The maximum number of (the newest) frames to return. "0" returns all frames.
+     */
+    std::vector<Entry> getEntries(size_t count = 0);
+private:
+    //The length byte limits KLF200 frames to 257 bytes
+    static constexpr size_t _maxFrameSize = 257;
+
+    std::mutex _entriesMutex;
+    std::vector<Entry> _entries;
+    size_t _nextIndex = 0;
+    size_t _count = 0;
+};
+
+}
+#endif
@@ -0,0 +1,256 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "Reactor.h"
+#include "../GD.h"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace Velux {
+
+std::mutex Reactor::_instanceMutex;
+std::weak_ptr<Reactor> Reactor::_instance;
+
+std::shared_ptr<Reactor> Reactor::getInstance() {
+  std::lock_guard<std::mutex> instanceGuard(_instanceMutex);
+  auto instance = _instance.lock();
+  if (!instance) {
+    instance = std::shared_ptr<Reactor>(new Reactor(), &Reactor::release);
+    _instance = instance;
+  }
+  return instance;
+}
+
+void Reactor::release(Reactor *reactor) {
+  //run() keeps using the object until it returns, so it can't be deleted from within a callback.
+  if (reactor->isReactorThread()) std::thread([reactor]() { delete reactor; }).detach();
+  else delete reactor;
+}
+
+Reactor::Reactor() {
+  _epollFd = epoll_create1(EPOLL_CLOEXEC);
+  _eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_epollFd == -1 || _eventFd == -1) {
+    GD::out.printCritical("Critical: Could not create epoll or event file descriptor: " + std::string(strerror(errno)));
+    return;
+  }
+
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = 0;
+  epoll_ctl(_epollFd, EPOLL_CTL_ADD, _eventFd, &event);
+
+  GD::bl->threadManager.start(_thread, true, &Reactor::run, this);
+  _threadId = _thread.get_id();
+}
+
+Reactor::~Reactor() {
+  _stop = true;
+  wakeUp();
+  GD::bl->threadManager.join(_thread);
+  if (_eventFd != -1) ::close(_eventFd);
+  if (_epollFd != -1) ::close(_epollFd);
+}
+
+int64_t Reactor::getTime() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Reactor::wakeUp() {
+  if (_eventFd == -1) return;
+  uint64_t value = 1;
+  if (write(_eventFd, &value, sizeof(value)) != sizeof(value)) {
+    //The counter can only overflow when nobody reads it. In that case epoll_wait() returns anyway.
+  }
+}
+
+uint64_t Reactor::addFileDescriptor(int32_t fileDescriptor, Callback onReadable) {
+  try {
+    if (fileDescriptor < 0 || _epollFd == -1) return 0;
+    std::lock_guard<std::mutex> mapGuard(_mutex);
+    uint64_t id = ++_currentId;
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.u64 = id;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fileDescriptor, &event) == -1) {
+      GD::out.printError("Error: Could not add file descriptor to epoll: " + std::string(strerror(errno)));
+      return 0;
+    }
+    _fileDescriptors.emplace(id, FileDescriptor{fileDescriptor, std::make_shared<Callback>(std::move(onReadable))});
+    return id;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return 0;
+}
+
+void Reactor::removeFileDescriptor(uint64_t id) {
+  try {
+    if (id == 0) return;
+    {
+      std::lock_guard<std::mutex> mapGuard(_mutex);
+      auto fileDescriptorIterator = _fileDescriptors.find(id);
+      if (fileDescriptorIterator != _fileDescriptors.end()) {
+        //Fails when the file descriptor was closed already, which removes it from epoll anyway.
+        epoll_ctl(_epollFd, EPOLL_CTL_DEL, fileDescriptorIterator->second.fileDescriptor, nullptr);
+        _fileDescriptors.erase(fileDescriptorIterator);
+      }
+    }
+    if (!isReactorThread()) {
+      //Wait for a running callback
+      std::lock_guard<std::mutex> callbackGuard(_callbackMutex);
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+uint64_t Reactor::addTimer(int64_t delay, Callback callback) {
+  try {
+    uint64_t id = 0;
+    {
+      std::lock_guard<std::mutex> mapGuard(_mutex);
+      id = ++_currentId;
+      int64_t deadline = getTime() + delay;
+      _timers.emplace(id, Timer{deadline, std::move(callback)});
+      _timerQueue.emplace(deadline, id);
+    }
+    if (!isReactorThread()) wakeUp();
+    return id;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return 0;
+}
+
+void Reactor::cancelTimer(uint64_t id) {
+  try {
+    if (id == 0) return;
+    {
+      std::lock_guard<std::mutex> mapGuard(_mutex);
+      auto timerIterator = _timers.find(id);
+      if (timerIterator != _timers.end()) {
+        _timerQueue.erase(std::make_pair(timerIterator->second.deadline, id));
+        _timers.erase(timerIterator);
+      }
+    }
+    if (!isReactorThread()) {
+      //The timer might be running right now.
+      std::lock_guard<std::mutex> callbackGuard(_callbackMutex);
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void Reactor::runTimers() {
+  while (!_stop) {
+    //Lock the callback mutex first, so a timer can't be cancelled between taking it from the queue and calling it.
+    std::lock_guard<std::mutex> callbackGuard(_callbackMutex);
+    Callback callback;
+    {
+      std::lock_guard<std::mutex> mapGuard(_mutex);
+      if (_timerQueue.empty() || _timerQueue.begin()->first > getTime()) return;
+      uint64_t id = _timerQueue.begin()->second;
+      _timerQueue.erase(_timerQueue.begin());
+      auto timerIterator = _timers.find(id);
+      if (timerIterator == _timers.end()) continue;
+      callback = std::move(timerIterator->second.callback);
+      _timers.erase(timerIterator);
+    }
+    try {
+      callback();
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
+
+void Reactor::run() {
+  std::array<epoll_event, 64> events{};
+  while (!_stop) {
+    try {
+      int32_t timeout = -1;
+      {
+        std::lock_guard<std::mutex> mapGuard(_mutex);
+        if (!_timerQueue.empty()) timeout = (int32_t)std::max((int64_t)0, std::min(_timerQueue.begin()->first - getTime(), (int64_t)60000));
+      }
+
+      int32_t eventCount = epoll_wait(_epollFd, events.data(), events.size(), timeout);
+      if (eventCount == -1) {
+        if (errno == EINTR) continue;
+        GD::out.printError("Error: epoll_wait failed: " + std::string(strerror(errno)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        continue;
+      }
+
+      for (int32_t i = 0; i < eventCount && !_stop; i++) {
+        uint64_t id = events[i].data.u64;
+        if (id == 0) {
+          uint64_t value = 0;
+          if (read(_eventFd, &value, sizeof(value)) != sizeof(value)) {
+            //Nothing to do. The counter was already reset.
+          }
+          continue;
+        }
+
+        std::lock_guard<std::mutex> callbackGuard(_callbackMutex);
+        std::shared_ptr<Callback> callback;
+        {
+          std::lock_guard<std::mutex> mapGuard(_mutex);
+          auto fileDescriptorIterator = _fileDescriptors.find(id);
+          //Removed by a previous callback of this iteration
+          if (fileDescriptorIterator == _fileDescriptors.end()) continue;
+          //The callback may remove itself, so hold a reference while it is running.
+          callback = fileDescriptorIterator->second.callback;
+        }
+        (*callback)();
+      }
+
+      runTimers();
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
+
+}
@@ -0,0 +1,131 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+namespace Velux
+{
+
+/**
+ * Event loop shared by all KLF200 interfaces. One thread waits on all registered file descriptors with epoll and runs
+ * timers, so no gateway needs its own reading thread or periodic wakeups.
+ *
+ * Callbacks are executed on the reactor thread one after another and must not block for long. After
+ * removeFileDescriptor() or cancelTimer() returns, the callback is not running and won't be called anymore.
+ */
+class Reactor
+{
+public:
+    typedef std::function<void()> Callback;
+
+    /**
+     * Returns the reactor of the module. It is created on the first call and destroyed when the last user releases it.
+     */
+    static std::shared_ptr<Reactor> getInstance();
+
+    /**
+     * Calls "onReadable" whenever "fileDescriptor" is readable or was closed by the other side. The file descriptor
+     * must stay open until removeFileDescriptor() is called.
+     *
+     * @return Returns a registration ID to pass to removeFileDescriptor() or "0" on error.
+     */
+    uint64_t addFileDescriptor(int32_t fileDescriptor, Callback onReadable);
+    void removeFileDescriptor(uint64_t id);
+
+    /**
+     * Calls "callback" once after "delay" milliseconds.
+     *
+     * @return Returns the timer ID to pass to cancelTimer().
+     */
+    uint64_t addTimer(int64_t delay, Callback callback);
+    void cancelTimer(uint64_t id);
+
+    bool isReactorThread() { return std::this_thread::get_id() == _threadId; }
+private:
+    struct FileDescriptor
+    {
+        int32_t fileDescriptor = -1;
+        std::shared_ptr<Callback> callback;
+    };
+
+    struct Timer
+    {
+        int64_t deadline = 0;
+        Callback callback;
+    };
+
+    static std::mutex _instanceMutex;
+    static std::weak_ptr<Reactor> _instance;
+
+    int32_t _epollFd = -1;
+    //Wakes up epoll_wait() when a timer is added or the reactor is stopped.
+    int32_t _eventFd = -1;
+    std::atomic_bool _stop{false};
+    std::thread _thread;
+    std::thread::id _threadId;
+
+    //Held while a callback is executed. Lets removeFileDescriptor() and cancelTimer() wait for a running callback.
+    std::mutex _callbackMutex;
+    //Protects the maps below.
+    std::mutex _mutex;
+    //ID "0" is the event FD.
+    uint64_t _currentId = 0;
+    std::unordered_map<uint64_t, FileDescriptor> _fileDescriptors;
+    std::unordered_map<uint64_t, Timer> _timers;
+    //Deadline and timer ID ordered by deadline
+    std::set<std::pair<int64_t, uint64_t>> _timerQueue;
+
+    Reactor();
+    ~Reactor();
+
+    /**
+     * Deleter of the instance. The destructor waits for the reactor thread to end, so when the last reference is
+     * released within a callback, the object is deleted on a separate thread.
+     */
+    static void release(Reactor* reactor);
+
+    static int64_t getTime();
+    void wakeUp();
+    void runTimers();
+    void run();
+};
+
+}
+#endif
@@ -0,0 +1,84 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef SLIP_H
+#define SLIP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Velux
+{
+
+/**
+ * SLIP framing as used by the KLF200 (RFC 1055).
+ */
+class Slip
+{
+public:
+    static std::vector<uint8_t> encode(const std::vector<uint8_t>& data);
+
+    /**
+     * Decodes a chunk of a SLIP stream. "frameCallback" is called with every complete frame. Bytes of an incomplete
+     * frame are kept until the next call.
+     */
+    template<typename Callback>
+    void decode(const uint8_t* data, size_t size, Callback&& frameCallback)
+    {
+        for(size_t i = 0; i < size; i++)
+        {
+            uint8_t byte = data[i];
+            if(byte == 0xC0)
+            {
+                _escape = false;
+                if(_frame.empty()) continue;
+                frameCallback(_frame);
+                _frame.clear();
+            }
+            else if(byte == 0xDB) _escape = true;
+            else if(_escape)
+            {
+                _escape = false;
+                if(byte == 0xDC) _frame.push_back(0xC0);
+                else if(byte == 0xDD) _frame.push_back(0xDB);
+            }
+            else _frame.push_back(byte);
+        }
+    }
+
+    void reset();
+private:
+    std::vector<uint8_t> _frame;
+    bool _escape = false;
+};
+
+}
+#endif
@@ -0,0 +1,169 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <future>
+#include <optional>
+#include <utility>
+
+namespace Velux
+{
+
+/**
+ * Coroutine returning a value of type "T". The coroutine doesn't run before it is awaited (co_await) or started with
+ * start() or get(). After a suspension it continues on the thread that resumes it, which for the awaitables of Klf200
+ * is the reactor thread.
+ */
+template<typename T>
+class Task
+{
+public:
+    struct promise_type
+    {
+        std::optional<T> value;
+        std::exception_ptr exception;
+        std::coroutine_handle<> continuation;
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                //Continue the awaiting coroutine without growing the stack.
+                auto continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(T result) { value = std::move(result); }
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task(Task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if(this != &other)
+        {
+            if(_handle) _handle.destroy();
+            _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task()
+    {
+        if(_handle) _handle.destroy();
+    }
+
+    bool await_ready() { return !_handle || _handle.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation)
+    {
+        _handle.promise().continuation = continuation;
+        return _handle;
+    }
+
+    T await_resume()
+    {
+        if(_handle.promise().exception) std::rethrow_exception(_handle.promise().exception);
+        return std::move(*_handle.promise().value);
+    }
+
+    /**
+     * Runs the coroutine without waiting for it. "callback" is called with the result on the thread that completes the
+     * coroutine. Exceptions are discarded, so the coroutine needs to handle them itself.
+     */
+    void start(std::function<void(T)> callback)
+    {
+        run(std::move(*this), std::move(callback));
+    }
+
+    /**
+     * Runs the coroutine and blocks until it is finished. Must not be called on the thread that resumes the coroutine
+     * (the reactor thread), because it would wait for itself.
+     */
+    T get()
+    {
+        std::promise<T> resultPromise;
+        auto resultFuture = resultPromise.get_future();
+        run(std::move(*this), [&resultPromise](T result) { resultPromise.set_value(std::move(result)); }, &resultPromise);
+        return resultFuture.get();
+    }
+private:
+    /**
+     * Coroutine that starts immediately and frees itself when finished.
+     */
+    struct Detached
+    {
+        struct promise_type
+        {
+            Detached get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() {}
+        };
+    };
+
+    std::coroutine_handle<promise_type> _handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+    static Detached run(Task task, std::function<void(T)> callback, std::promise<T>* resultPromise = nullptr)
+    {
+        std::optional<T> result;
+        try
+        {
+            result.emplace(co_await task);
+        }
+        catch(...)
+        {
+            if(resultPromise) resultPromise->set_exception(std::current_exception());
+        }
+        if(result) callback(std::move(*result));
+    }
+};
+
+}
+#endif
@@ -0,0 +1,76 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "TcpTransport.h"
+
+namespace Velux {
+
+TcpTransport::TcpTransport(const std::string &hostname, uint16_t port, bool tls, uint32_t readTimeout, uint32_t writeTimeout) {
+  C1Net::TcpSocketInfo tcp_socket_info;
+  tcp_socket_info.read_timeout = readTimeout;
+  tcp_socket_info.write_timeout = writeTimeout;
+
+  C1Net::TcpSocketHostInfo tcp_socket_host_info{
+      .host = hostname,
+      .port = port,
+      .tls = tls,
+      .verify_certificate = false,
+      .connection_retries = 1
+  };
+
+  _socket = std::make_unique<C1Net::TcpSocket>(tcp_socket_info, tcp_socket_host_info);
+}
+
+void TcpTransport::open() {
+  _socket->Open();
+}
+
+void TcpTransport::close() {
+  _socket->Shutdown();
+}
+
+bool TcpTransport::isConnected() {
+  return _socket->Connected();
+}
+
+int32_t TcpTransport::getFileDescriptor() {
+  return _socket->GetFileDescriptor();
+}
+
+size_t TcpTransport::read(uint8_t *buffer, size_t size) {
+  _moreData = false;
+  return _socket->Read(buffer, size, _moreData);
+}
+
+void TcpTransport::send(const std::vector<uint8_t> &data) {
+  _socket->Send(data);
+}
+
+}
@@ -0,0 +1,72 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef TCPTRANSPORT_H
+#define TCPTRANSPORT_H
+
+#include "Transport.h"
+
+#include <homegear-base/BaseLib.h>
+
+#include <memory>
+#include <string>
+
+namespace Velux
+{
+
+/**
+ * TCP connection to a KLF200 with or without TLS. The KLF200 itself only accepts TLS, plain TCP is meant for the
+ * simulator.
+ */
+class TcpTransport : public Transport
+{
+public:
+    /**
+     * @param readTimeout Time in milliseconds read() waits for data. The default of "0" never waits, which is required
+     * when reading on the reactor thread.
+     */
+    TcpTransport(const std::string& hostname, uint16_t port, bool tls, uint32_t readTimeout = 0, uint32_t writeTimeout = 5000);
+    ~TcpTransport() override = default;
+
+    void open() override;
+    void close() override;
+    bool isConnected() override;
+    int32_t getFileDescriptor() override;
+    //Set by C1Net when GnuTLS still holds decrypted data of the last record (gnutls_record_check_pending()).
+    bool hasBufferedData() override { return _moreData; }
+    size_t read(uint8_t* buffer, size_t size) override;
+    void send(const std::vector<uint8_t>& data) override;
+private:
+    std::unique_ptr<C1Net::TcpSocket> _socket;
+    bool _moreData = false;
+};
+
+}
+#endif
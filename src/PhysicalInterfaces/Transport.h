@@ -0,0 +1,92 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Velux
+{
+
+/**
+ * Byte stream connection to a KLF200. Klf200 only does framing, request correlation and initialization on top of it,
+ * so the same logic runs on TLS, plain TCP (e.g. against the simulator) or an in-process loopback. Klf200 waits for
+ * data with Reactor, so every transport needs to provide a file descriptor.
+ */
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    /**
+     * Opens the connection. Does nothing when the connection is already open.
+     */
+    virtual void open() = 0;
+
+    /**
+     * Closes the connection and wakes up a blocking read(). Can be called from any thread.
+     */
+    virtual void close() = 0;
+    virtual bool isConnected() = 0;
+
+    /**
+     * Returns a file descriptor that becomes readable when read() returns without waiting (data or a closed
+     * connection). Only valid while the connection is open.
+     */
+    virtual int32_t getFileDescriptor() = 0;
+
+    /**
+     * Returns "true" when the last read() left data in an internal buffer (e.g. the rest of a TLS record). Such data
+     * doesn't make the file descriptor readable.
+     */
+    virtual bool hasBufferedData() { return false; }
+
+    /**
+     * Reads up to "size" bytes.
+     *
+     * @return Returns the number of bytes read.
+     * @throws C1Net::TimeoutException when no data was received within the read timeout.
+     * @throws C1Net::ClosedException when the connection is closed.
+     */
+    virtual size_t read(uint8_t* buffer, size_t size) = 0;
+
+    /**
+     * Sends all bytes of "data".
+     *
+     * @throws C1Net::ClosedException when the connection is closed.
+     */
+    virtual void send(const std::vector<uint8_t>& data) = 0;
+};
+
+}
+#endif
@@ -0,0 +1,94 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "WriterPool.h"
+#include "../GD.h"
+
+namespace Velux {
+
+std::mutex WriterPool::_instanceMutex;
+std::weak_ptr<WriterPool> WriterPool::_instance;
+
+std::shared_ptr<WriterPool> WriterPool::getInstance() {
+  std::lock_guard<std::mutex> instanceGuard(_instanceMutex);
+  auto instance = _instance.lock();
+  if (!instance) {
+    instance = std::make_shared<WriterPool>();
+    _instance = instance;
+  }
+  return instance;
+}
+
+WriterPool::WriterPool() {
+  _threads.resize(_threadCount);
+  for (auto &thread: _threads) {
+    GD::bl->threadManager.start(thread, true, &WriterPool::run, this);
+  }
+}
+
+WriterPool::~WriterPool() {
+  {
+    std::lock_guard<std::mutex> jobsGuard(_jobsMutex);
+    _stop = true;
+  }
+  _jobsConditionVariable.notify_all();
+  for (auto &thread: _threads) {
+    GD::bl->threadManager.join(thread);
+  }
+}
+
+void WriterPool::post(Job job) {
+  {
+    std::lock_guard<std::mutex> jobsGuard(_jobsMutex);
+    _jobs.push_back(std::move(job));
+  }
+  _jobsConditionVariable.notify_one();
+}
+
+void WriterPool::run() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> jobsGuard(_jobsMutex);
+      _jobsConditionVariable.wait(jobsGuard, [&] { return _stop || !_jobs.empty(); });
+      if (_stop) return;
+      job = std::move(_jobs.front());
+      _jobs.pop_front();
+    }
+    try {
+      job();
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
+
+}
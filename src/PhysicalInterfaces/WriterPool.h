@@ -0,0 +1,84 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef WRITERPOOL_H
+#define WRITERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Velux
+{
+
+/**
+ * Small thread pool shared by all KLF200 interfaces to write to the transports. Writing may block (e.g. on a full TCP
+ * send buffer), so it must not be done on the reactor thread. The number of threads doesn't depend on the number of
+ * gateways.
+ *
+ * Jobs are executed in the order they were posted, but jobs may run in parallel. Klf200 therefore only has one job per
+ * interface at a time.
+ */
+class WriterPool
+{
+public:
+    typedef std::function<void()> Job;
+
+    /**
+     * Returns the pool of the module. It is created on the first call and destroyed when the last user releases it. It
+     * must not be released within a job.
+     */
+    static std::shared_ptr<WriterPool> getInstance();
+
+    WriterPool();
+    ~WriterPool();
+
+    void post(Job job);
+private:
+    static constexpr size_t _threadCount = 2;
+
+    static std::mutex _instanceMutex;
+    static std::weak_ptr<WriterPool> _instance;
+
+    std::mutex _jobsMutex;
+    std::condition_variable _jobsConditionVariable;
+    std::deque<Job> _jobs;
+    bool _stop = false;
+    std::vector<std::thread> _threads;
+
+    void run();
+};
+
+}
+#endif
@@ -0,0 +1,93 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#include "StageTrace.h"
+
+namespace Velux
+{
+
+std::atomic_bool StageTrace::_enabled{false};
+
+const char* StageTrace::getStageName(size_t index)
+{
+    switch(index)
+    {
+        case 0: return "total";
+        case 1: return "slipFrameComplete";
+        case 2: return "packetConstructed";
+        case 3: return "centralReceived";
+        case 4: return "decoded";
+        case 5: return "saved";
+        case 6: return "eventRaised";
+        default: return "unknown";
+    }
+}
+
+void StageTrace::record(const StageTimes& stageTimes)
+{
+    int64_t firstTime = 0;
+    int64_t lastTime = 0;
+    for(size_t i = 0; i < stageCount; i++)
+    {
+        if(stageTimes[i] == 0) continue;
+        if(lastTime != 0) _histograms[i].record(stageTimes[i] - lastTime);
+        else firstTime = stageTimes[i];
+        lastTime = stageTimes[i];
+    }
+    if(firstTime != lastTime) _histograms[0].record(lastTime - firstTime);
+}
+
+BaseLib::PVariable StageTrace::getStatistics()
+{
+    auto result = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tStruct);
+    for(size_t i = 0; i < stageCount; i++)
+    {
+        auto snapshot = _histograms[i].getSnapshot();
+        auto stageStruct = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tStruct);
+        stageStruct->structValue->emplace("count", std::make_shared<BaseLib::Variable>((int64_t)snapshot.count));
+        stageStruct->structValue->emplace("mean", std::make_shared<BaseLib::Variable>(snapshot.getMean()));
+        stageStruct->structValue->emplace("p50", std::make_shared<BaseLib::Variable>(snapshot.getPercentile(50)));
+        stageStruct->structValue->emplace("p90", std::make_shared<BaseLib::Variable>(snapshot.getPercentile(90)));
+        stageStruct->structValue->emplace("p99", std::make_shared<BaseLib::Variable>(snapshot.getPercentile(99)));
+        stageStruct->structValue->emplace("max", std::make_shared<BaseLib::Variable>(snapshot.max));
+        result->structValue->emplace(getStageName(i), stageStruct);
+    }
+    return result;
+}
+
+void StageTrace::reset()
+{
+    for(auto& histogram : _histograms)
+    {
+        histogram.reset();
+    }
+}
+
+}
@@ -0,0 +1,93 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Homegear.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+
+#ifndef STAGETRACE_H_
+#define STAGETRACE_H_
+
+#include "PhysicalInterfaces/LatencyHistogram.h"
+
+#include <homegear-base/BaseLib.h>
+
+#include <array>
+#include <atomic>
+
+namespace Velux
+{
+
+/**
+ * Aggregates the time received frames spend in each stage of the receive pipeline, from reading the socket to raising
+ * the events. When disabled, the pipeline neither reads the clock nor allocates anything.
+ */
+class StageTrace
+{
+public:
+    enum class Stage : uint8_t
+    {
+        socketRead = 0,
+        slipFrameComplete = 1,
+        packetConstructed = 2,
+        centralReceived = 3,
+        decoded = 4,
+        saved = 5,
+        eventRaised = 6
+    };
+    static constexpr size_t stageCount = 7;
+
+    //Time (see LatencyHistogram::getTime()) each stage was completed. "0" when the stage was not reached.
+    typedef std::array<int64_t, stageCount> StageTimes;
+
+    static bool isEnabled() { return _enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool value) { _enabled.store(value, std::memory_order_relaxed); }
+
+    /**
+     * Adds the durations of the stages of one frame. Stages that were not reached are skipped.
+     */
+    void record(const StageTimes& stageTimes);
+
+    /**
+     * Returns count, mean, percentiles and maximum (in microseconds) of every stage and of the whole pipeline.
+     */
+    BaseLib::PVariable getStatistics();
+    void reset();
+
+    /**
+     * Returns the name used in getStatistics() for the histogram with the given index. Index "0" is the whole pipeline.
+     */
+    static const char* getStageName(size_t index);
+private:
+    static std::atomic_bool _enabled;
+
+    //Element "i" contains the time from stage "i - 1" to stage "i". Element "0" contains the time of the whole pipeline.
+    std::array<LatencyHistogram, stageCount> _histograms;
+};
+
+}
+
+#endif
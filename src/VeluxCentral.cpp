@@ -32,7 +32,12 @@
 #include "Velux.h"
 #include "GD.h"
 
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
 #include <iomanip>
+#include <unordered_set>
 
 namespace Velux
 {
@@ -53,10 +58,38 @@ void VeluxCentral::init()
     _initialized = true;
 	_searching = false;
 
+    auto setting = GD::family->getFamilySetting("maxparameterstaleness");
+    if(setting) _maxParameterStaleness = setting->integerValue < 0 ? 0 : setting->integerValue;
+    GD::out.printDebug("Debug: maxParameterStaleness set to " + std::to_string(_maxParameterStaleness) + " ms.");
+
+    setting = GD::family->getFamilySetting("lazypeerloading");
+    if(setting) _lazyPeerLoading = setting->integerValue != 0 || setting->stringValue == "true";
+
+    setting = GD::family->getFamilySetting("metricsfile");
+    if(setting) _metricsFile = setting->stringValue;
+    setting = GD::family->getFamilySetting("metricsinterval");
+    if(setting && setting->integerValue > 0) _metricsInterval = setting->integerValue;
+    setting = GD::family->getFamilySetting("stagetracing");
+    if(setting) StageTrace::setEnabled(setting->integerValue != 0 || setting->stringValue == "true");
+
+    _peerIndex.store(std::make_shared<PeerIndex>());
+
+    //The node tables of all configured interfaces are created here, so the packet path finds them without locking.
+    auto nodeTables = std::make_shared<NodeTables>();
     for(auto& physicalInterface : GD::physicalInterfaces)
     {
         _physicalInterfaceEventhandlers[physicalInterface.first] = physicalInterface.second->addEventHandler((BaseLib::Systems::IPhysicalInterface::IPhysicalInterfaceEventSink*)this);
+        nodeTables->emplace(physicalInterface.first, std::make_shared<NodeTable>());
     }
+    _nodeTables.store(std::move(nodeTables));
+
+    _localRpcMethods.emplace("getLatencyStatistics", std::bind(&VeluxCentral::getLatencyStatistics, this, std::placeholders::_1, std::placeholders::_2));
+    _localRpcMethods.emplace("getMetrics", std::bind(&VeluxCentral::getMetrics, this, std::placeholders::_1, std::placeholders::_2));
+    _localRpcMethods.emplace("getStageLatencies", std::bind(&VeluxCentral::getStageLatencies, this, std::placeholders::_1, std::placeholders::_2));
+    _localRpcMethods.emplace("setValues", std::bind(&VeluxCentral::setValues, this, std::placeholders::_1, std::placeholders::_2));
+
+    _stopWorkerThread = false;
+    _bl->threadManager.start(_workerThread, true, &VeluxCentral::worker, this);
 }
 
 VeluxCentral::~VeluxCentral()
@@ -76,6 +109,16 @@ void VeluxCentral::dispose(bool wait)
             //Just to make sure cycle through all physical devices. If event handler is not removed => segfault
             physicalInterface.second->removeEventHandler(_physicalInterfaceEventhandlers[physicalInterface.first]);
         }
+
+        _stopWorkerThread = true;
+        GD::out.printDebug("Debug: Waiting for worker thread of device " + std::to_string(_deviceId) + "...");
+        _bl->threadManager.join(_workerThread);
+        flushPeerParameters(true);
+        {
+            std::lock_guard<std::mutex> deletedPeersGuard(_deletedPeers->mutex);
+            _deletedPeers->disposed = true;
+        }
+        reclaimDeletedPeers();
 	}
     catch(const std::exception& ex)
     {
@@ -93,7 +136,8 @@ bool VeluxCentral::onPacketReceived(std::string& senderId, std::shared_ptr<BaseL
 
         if(veluxPacket->getNodeId() == -1) return false;
 
-        if(_bl->debugLevel >= 4) _bl->out.printInfo(BaseLib::HelperFunctions::getTimeString(veluxPacket->getTimeReceived()) + " Velux packet received (" + senderId + "): " + BaseLib::HelperFunctions::getHexString(veluxPacket->getBinary()) + " - Sender node: " + std::to_string(veluxPacket->getNodeId()));
+        //Received frames are recorded by the packet trace of the interface (CLI command "packettrace").
+        if(veluxPacket->getStageTimes()) veluxPacket->setStageTime(StageTrace::Stage::centralReceived, LatencyHistogram::getTime());
 
         auto peer = getPeer(senderId, veluxPacket->getNodeId());
         if(peer)
@@ -101,6 +145,7 @@ bool VeluxCentral::onPacketReceived(std::string& senderId, std::shared_ptr<BaseL
             peer->packetReceived(veluxPacket);
             return true;
         }
+        _droppedUnknownNodeFrames++;
     }
     catch(const std::exception& ex)
     {
@@ -114,24 +159,74 @@ void VeluxCentral::loadPeers()
 	try
 	{
 		std::shared_ptr<BaseLib::Database::DataTable> rows = _bl->db->getPeers(_deviceId);
+		std::vector<PeerToLoad> peers;
+		peers.reserve(rows->size());
 		for(BaseLib::Database::DataTable::iterator row = rows->begin(); row != rows->end(); ++row)
 		{
-			int32_t peerId = row->second.at(0)->intValue;
-			GD::out.printMessage("Loading peer " + std::to_string(peerId));
-			size_t nodeId = row->second.at(2)->intValue;
-			auto peer = std::make_shared<VeluxPeer>(peerId, nodeId, row->second.at(3)->textValue, _deviceId, this);
-			if(!peer->load(this)) continue;
-			if(!peer->getRpcDevice()) continue;
-			std::lock_guard<std::mutex> peersGuard(_peersMutex);
-			if(!peer->getSerialNumber().empty()) _peersBySerial[peer->getSerialNumber()] = peer;
-			_peersById[peerId] = peer;
-			_peersByInterface[peer->getPhysicalInterfaceId()][nodeId] = peer;
+			PeerToLoad peer;
+			peer.peerId = row->second.at(0)->intValue;
+			peer.nodeId = row->second.at(2)->intValue;
+			peer.serialNumber = row->second.at(3)->textValue;
+			peers.push_back(std::move(peer));
+		}
+
+		//Loading a peer is independent of all other peers, so the peers are loaded in parallel and only added to the
+		//peer maps at the end.
+		std::atomic<size_t> nextPeer{0};
+		size_t threadCount = std::min((size_t)std::max(std::thread::hardware_concurrency(), 1u), (size_t)8);
+		threadCount = std::min(threadCount, peers.size());
+		if(threadCount > 1)
+		{
+			std::vector<std::thread> threads(threadCount);
+			for(auto& thread : threads)
+			{
+				_bl->threadManager.start(thread, false, &VeluxCentral::loadPeersThread, this, &peers, &nextPeer);
+			}
+			for(auto& thread : threads)
+			{
+				_bl->threadManager.join(thread);
+			}
+		}
+		else loadPeersThread(&peers, &nextPeer);
+
+		std::lock_guard<std::mutex> peersGuard(_peersMutex);
+		for(auto& peer : peers)
+		{
+			if(!peer.peer) continue;
+			if(!peer.peer->getSerialNumber().empty()) _peersBySerial[peer.peer->getSerialNumber()] = peer.peer;
+			_peersById[peer.peerId] = peer.peer;
+			if(!peer.peer->isScene()) setNodePeer(peer.peer->getPhysicalInterfaceId(), peer.nodeId, peer.peer);
 		}
+		publishPeers();
 	}
 	catch(const std::exception& ex)
     {
     	GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
     }
+	//Also set when loading failed, so the worker doesn't wait for peers which will never be published.
+	_peersLoaded = true;
+}
+
+void VeluxCentral::loadPeersThread(std::vector<PeerToLoad>* peers, std::atomic<size_t>* nextPeer)
+{
+	try
+	{
+		for(size_t index = (*nextPeer)++; index < peers->size(); index = (*nextPeer)++)
+		{
+			auto& peerToLoad = peers->at(index);
+			GD::out.printMessage("Loading peer " + std::to_string(peerToLoad.peerId));
+			auto peer = std::make_shared<VeluxPeer>(peerToLoad.peerId, peerToLoad.nodeId, peerToLoad.serialNumber, _deviceId, this);
+			peer->setMaxParameterStaleness(_maxParameterStaleness);
+			peer->setLazyLoading(_lazyPeerLoading);
+			if(!peer->load(this)) continue;
+			if(!peer->getRpcDevice()) continue;
+			peerToLoad.peer = std::move(peer);
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
 }
 
 void VeluxCentral::loadVariables()
@@ -189,17 +284,55 @@ void VeluxCentral::saveVariables()
     }
 }
 
+void VeluxCentral::setNodePeer(const std::string& interfaceId, size_t nodeId, const std::shared_ptr<VeluxPeer>& peer)
+{
+	try
+	{
+		if(nodeId >= 256) return;
+		auto nodeTables = _nodeTables.load(std::memory_order_acquire);
+		auto nodeTableIterator = nodeTables->find(interfaceId);
+		if(nodeTableIterator == nodeTables->end())
+		{
+			auto newNodeTables = std::make_shared<NodeTables>(*nodeTables);
+			nodeTableIterator = newNodeTables->emplace(interfaceId, std::make_shared<NodeTable>()).first;
+			nodeTableIterator->second->peers[nodeId].store(peer, std::memory_order_release);
+			_nodeTables.store(std::move(newNodeTables), std::memory_order_release);
+			return;
+		}
+		nodeTableIterator->second->peers[nodeId].store(peer, std::memory_order_release);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
+void VeluxCentral::removeNodePeer(const std::string& interfaceId, size_t nodeId, const std::shared_ptr<VeluxPeer>& peer)
+{
+	try
+	{
+		if(nodeId >= 256) return;
+		auto nodeTables = _nodeTables.load(std::memory_order_acquire);
+		auto nodeTableIterator = nodeTables->find(interfaceId);
+		if(nodeTableIterator == nodeTables->end()) return;
+		auto expectedPeer = peer;
+		nodeTableIterator->second->peers[nodeId].compare_exchange_strong(expectedPeer, std::shared_ptr<VeluxPeer>(), std::memory_order_acq_rel);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
 std::shared_ptr<VeluxPeer> VeluxCentral::getPeer(const std::string& interfaceId, size_t nodeId)
 {
 	try
 	{
-		std::lock_guard<std::mutex> peersGuard(_peersMutex);
-		auto peersByInterfaceIterator = _peersByInterface.find(interfaceId);
-		if(peersByInterfaceIterator != _peersByInterface.end())
-        {
-		    auto nodeIdIterator = peersByInterfaceIterator->second.find(nodeId);
-		    if(nodeIdIterator != peersByInterfaceIterator->second.end()) return nodeIdIterator->second;
-        }
+		//Called for every received packet, so no lock is taken.
+		if(nodeId >= 256) return std::shared_ptr<VeluxPeer>();
+		auto nodeTables = _nodeTables.load(std::memory_order_acquire);
+		auto nodeTableIterator = nodeTables->find(interfaceId);
+		if(nodeTableIterator != nodeTables->end()) return nodeTableIterator->second->peers[nodeId].load(std::memory_order_acquire);
 	}
 	catch(const std::exception& ex)
     {
@@ -212,9 +345,9 @@ std::shared_ptr<VeluxPeer> VeluxCentral::getPeer(uint64_t id)
 {
 	try
 	{
-		std::lock_guard<std::mutex> peersGuard(_peersMutex);
-		auto peersByIdIterator = _peersById.find(id);
-		if(peersByIdIterator != _peersById.end()) return std::dynamic_pointer_cast<VeluxPeer>(peersByIdIterator->second);
+		auto peerIndex = _peerIndex.load(std::memory_order_acquire);
+		auto peersByIdIterator = peerIndex->peersById.find(id);
+		if(peersByIdIterator != peerIndex->peersById.end()) return peersByIdIterator->second;
 	}
 	catch(const std::exception& ex)
     {
@@ -227,9 +360,9 @@ std::shared_ptr<VeluxPeer> VeluxCentral::getPeer(const std::string& serialNumber
 {
 	try
 	{
-		std::lock_guard<std::mutex> peersGuard(_peersMutex);
-		auto peersBySerialIterator = _peersBySerial.find(serialNumber);
-		if(peersBySerialIterator != _peersBySerial.end()) return std::dynamic_pointer_cast<VeluxPeer>(peersBySerialIterator->second);
+		auto peerIndex = _peerIndex.load(std::memory_order_acquire);
+		auto peersBySerialIterator = peerIndex->peersBySerial.find(serialNumber);
+		if(peersBySerialIterator != peerIndex->peersBySerial.end()) return peersBySerialIterator->second;
 	}
 	catch(const std::exception& ex)
     {
@@ -238,6 +371,49 @@ std::shared_ptr<VeluxPeer> VeluxCentral::getPeer(const std::string& serialNumber
     return std::shared_ptr<VeluxPeer>();
 }
 
+void VeluxCentral::publishPeers()
+{
+	try
+	{
+		auto peerIndex = std::make_shared<PeerIndex>();
+		for(auto& peer : _peersById)
+		{
+			auto veluxPeer = std::dynamic_pointer_cast<VeluxPeer>(peer.second);
+			if(veluxPeer) peerIndex->peersById.emplace(peer.first, std::move(veluxPeer));
+		}
+		peerIndex->peersBySerial.reserve(_peersBySerial.size());
+		for(auto& peer : _peersBySerial)
+		{
+			auto veluxPeer = std::dynamic_pointer_cast<VeluxPeer>(peer.second);
+			if(veluxPeer) peerIndex->peersBySerial.emplace(peer.first, std::move(veluxPeer));
+		}
+		_peerIndex.store(std::move(peerIndex), std::memory_order_release);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
+std::vector<std::shared_ptr<VeluxPeer>> VeluxCentral::getVeluxPeers()
+{
+	std::vector<std::shared_ptr<VeluxPeer>> peers;
+	try
+	{
+		auto peerIndex = _peerIndex.load(std::memory_order_acquire);
+		peers.reserve(peerIndex->peersById.size());
+		for(auto& peer : peerIndex->peersById)
+		{
+			peers.push_back(peer.second);
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return peers;
+}
+
 void VeluxCentral::deletePeer(uint64_t id)
 {
 	try
@@ -268,19 +444,25 @@ void VeluxCentral::deletePeer(uint64_t id)
 			std::lock_guard<std::mutex> peersGuard(_peersMutex);
 			_peersBySerial.erase(peer->getSerialNumber());
 			_peersById.erase(id);
-			_peersByInterface[peer->getPhysicalInterfaceId()].erase(peer->getAddress());
+			removeNodePeer(peer->getPhysicalInterfaceId(), peer->getAddress(), peer);
+			publishPeers();
 		}
 
-        int32_t i = 0;
-        while(peer.use_count() > 1 && i < 600)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            i++;
-        }
-        if(i == 600) GD::out.printError("Error: Peer deletion took too long.");
-
-		peer->deleteFromDatabase();
-		GD::out.printMessage("Removed peer " + std::to_string(peer->getID()));
+		//Packets or RPC calls in progress might still use the peer, so the database entries are deleted after the last
+		//reference is released. The destructor might run on the reactor thread, so it only queues the ID for the worker
+		//thread.
+		std::shared_ptr<DeletedPeers> deletedPeers = _deletedPeers;
+		peer->setDestructionCallback([deletedPeers](uint64_t peerId)
+		{
+			std::unique_lock<std::mutex> deletedPeersGuard(deletedPeers->mutex);
+			if(!deletedPeers->disposed)
+			{
+				deletedPeers->peerIds.push_back(peerId);
+				return;
+			}
+			deletedPeersGuard.unlock();
+			GD::bl->db->deletePeer(peerId);
+		});
 	}
 	catch(const std::exception& ex)
     {
@@ -288,6 +470,29 @@ void VeluxCentral::deletePeer(uint64_t id)
     }
 }
 
+void VeluxCentral::reclaimDeletedPeers()
+{
+	try
+	{
+		std::vector<uint64_t> peerIds;
+		{
+			std::lock_guard<std::mutex> deletedPeersGuard(_deletedPeers->mutex);
+			if(_deletedPeers->peerIds.empty()) return;
+			peerIds.swap(_deletedPeers->peerIds);
+		}
+
+		for(auto peerId : peerIds)
+		{
+			_bl->db->deletePeer(peerId);
+			GD::out.printMessage("Removed peer " + std::to_string(peerId));
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
 std::string VeluxCentral::handleCliCommand(std::string command)
 {
 	try
@@ -297,11 +502,17 @@ std::string VeluxCentral::handleCliCommand(std::string command)
 		{
 			stringStream << "List of commands (shortcut in brackets):" << std::endl << std::endl;
 			stringStream << "For more information about the individual command type: COMMAND help" << std::endl << std::endl;
+			stringStream << "capture (cap)\t\tRecords the byte stream of a gateway into a file" << std::endl;
+			stringStream << "latency (lat)\t\tPrints the round trip latencies of the gateways" << std::endl;
+			stringStream << "metrics (me)\t\tPrints the counters of the central and the gateways" << std::endl;
+			stringStream << "packettrace (pt)\tPrints the last frames sent to and received from the gateways" << std::endl;
 			stringStream << "peers list (ls)\t\tList all peers" << std::endl;
 			stringStream << "peers remove (prm)\tRemove a peer (without unpairing)" << std::endl;
 			stringStream << "peers select (ps)\tSelect a peer" << std::endl;
 			stringStream << "peers setname (pn)\tName a peer" << std::endl;
+			stringStream << "replay (rp)\t\tFeeds a capture file through the receive path" << std::endl;
 			stringStream << "search (sp)\t\tSearches for new devices" << std::endl;
+			stringStream << "stagetrace (st)\t\tPrints the time received frames spend in each processing stage" << std::endl;
 			stringStream << "unselect (u)\t\tUnselect this device" << std::endl;
 			return stringStream.str();
 		}
@@ -404,7 +615,9 @@ std::string VeluxCentral::handleCliCommand(std::string command)
 					return stringStream.str();
 				}
 
-				if(_peersById.empty())
+				//The listing works on a snapshot, so formatting it doesn't block packet dispatch.
+				auto peerIndex = _peerIndex.load(std::memory_order_acquire);
+				if(peerIndex->peersById.empty())
 				{
 					stringStream << "No peers are paired to this central." << std::endl;
 					return stringStream.str();
@@ -447,10 +660,8 @@ std::string VeluxCentral::handleCliCommand(std::string command)
 					<< std::setw(configPendingWidth) << " " << bar
 					<< std::setw(unreachWidth) << " "
 					<< std::endl;
-				_peersMutex.lock();
-				for(std::map<uint64_t, std::shared_ptr<BaseLib::Systems::Peer>>::iterator i = _peersById.begin(); i != _peersById.end(); ++i)
+				for(auto i = peerIndex->peersById.begin(); i != peerIndex->peersById.end(); ++i)
 				{
-					std::shared_ptr<VeluxPeer> peer(std::dynamic_pointer_cast<VeluxPeer>(i->second));
 					if(filterType == "id")
 					{
 						uint64_t id = BaseLib::Math::getNumber(filterValue, false);
@@ -530,7 +741,6 @@ std::string VeluxCentral::handleCliCommand(std::string command)
 					}
 					stringStream << std::endl << std::dec;
 				}
-				_peersMutex.unlock();
 				stringStream << "────────────┴───────────────────────────┴──────────┴───────────────────┴──────┴───────────────────────────┴──────────┴────────────────┴────────" << std::endl;
 				if(firmwareUpdates) stringStream << std::endl << "*: Firmware update available." << std::endl;
 
@@ -538,7 +748,6 @@ std::string VeluxCentral::handleCliCommand(std::string command)
 			}
 			catch(const std::exception& ex)
 			{
-				_peersMutex.unlock();
 				GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
 			}
 		}
@@ -590,71 +799,489 @@ std::string VeluxCentral::handleCliCommand(std::string command)
 			}
 			return stringStream.str();
 		}
-		else if(command.compare(0, 6, "search") == 0 || command.compare(0, 2, "sp") == 0)
+		else if(command.compare(0, 7, "capture") == 0 || command.compare(0, 3, "cap") == 0)
 		{
+			std::string action;
+			std::string interfaceId;
+			std::string filename;
+
 			std::stringstream stream(command);
 			std::string element;
-			int32_t offset = (command.at(1) == 'p') ? 0 : 1;
 			int32_t index = 0;
 			while(std::getline(stream, element, ' '))
 			{
-				if(index < 1 + offset)
+				if(index == 0)
 				{
 					index++;
 					continue;
 				}
-				else if(index == 1 + offset)
+				else if(index == 1) action = element;
+				else if(index == 2) interfaceId = element;
+				else if(index == 3) filename = element;
+				else filename += ' ' + element;
+				index++;
+			}
+			if(action == "help" || (action != "start" && action != "stop") || interfaceId.empty() || (action == "start" && filename.empty()))
+			{
+				stringStream << "Description: This command records the raw byte stream of a gateway in both directions into a file. The file can be fed into \"replay\"." << std::endl;
+				stringStream << "Usage: capture start INTERFACE FILE" << std::endl;
+				stringStream << "       capture stop INTERFACE" << std::endl << std::endl;
+				stringStream << "Parameters:" << std::endl;
+				stringStream << "  INTERFACE:\tThe ID of the interface to record." << std::endl;
+				stringStream << "  FILE:\t\tThe file to write. An existing file is overwritten." << std::endl;
+				return stringStream.str();
+			}
+
+			auto interfaceIterator = GD::physicalInterfaces.find(interfaceId);
+			if(interfaceIterator == GD::physicalInterfaces.end()) return "Unknown interface.\n";
+
+			if(action == "start")
+			{
+				if(!interfaceIterator->second->startCapture(filename)) return "Could not open file " + filename + ".\n";
+				stringStream << "Capture started." << std::endl;
+			}
+			else
+			{
+				interfaceIterator->second->stopCapture();
+				stringStream << "Capture stopped." << std::endl;
+			}
+			return stringStream.str();
+		}
+		else if(command.compare(0, 6, "replay") == 0 || command.compare(0, 2, "rp") == 0)
+		{
+			std::string interfaceId;
+			std::string filename;
+			bool originalPace = false;
+
+			std::stringstream stream(command);
+			std::string element;
+			int32_t index = 0;
+			while(std::getline(stream, element, ' '))
+			{
+				if(index == 0)
+				{
+					index++;
+					continue;
+				}
+				else if(index == 1) interfaceId = element;
+				else if(index == 2) filename = element;
+				else if(index == 3) originalPace = (element == "realtime");
+				index++;
+			}
+			if(interfaceId.empty() || interfaceId == "help" || filename.empty())
+			{
+				stringStream << "Description: This command feeds the received data of a capture file through the receive path of an interface as if it came from the gateway. Only interfaces of type \"klf200-replay\" can be used, which never connect to a gateway." << std::endl;
+				stringStream << "Usage: replay INTERFACE FILE [realtime]" << std::endl << std::endl;
+				stringStream << "Parameters:" << std::endl;
+				stringStream << "  INTERFACE:\tThe ID of the interface to feed the data into." << std::endl;
+				stringStream << "  FILE:\t\tThe capture file to replay." << std::endl;
+				stringStream << "  realtime:\tReproduce the original timing in the background. The result is written to the log. Without it the file is replayed as fast as possible." << std::endl;
+				return stringStream.str();
+			}
+
+			auto interfaceIterator = GD::physicalInterfaces.find(interfaceId);
+			if(interfaceIterator == GD::physicalInterfaces.end()) return "Unknown interface.\n";
+
+			if(!interfaceIterator->second->isReplayInterface()) return "The interface is no replay interface. Please add an interface of type \"klf200-replay\" to veluxklf200.conf.\n";
+			if(interfaceIterator->second->isReplaying()) return "A replay is already running on this interface.\n";
+			if(originalPace)
+			{
+				if(!interfaceIterator->second->startReplay(filename)) return "Could not start replay of " + filename + ". See log file for more details.\n";
+				return "Replay started. The result is written to the log when it is finished.\n";
+			}
+
+			Klf200::ReplayResult result;
+			if(!interfaceIterator->second->replay(filename, result)) return "Could not replay capture file " + filename + ". See log file for more details.\n";
+			double seconds = (double)result.duration / 1000000000.0;
+			stringStream << "Replayed " << result.frames << " frames (" << result.bytes << " bytes, " << result.records << " records) in " << seconds << " s";
+			if(result.duration > 0) stringStream << " (" << (int64_t)((double)result.frames / seconds) << " frames/s)";
+			stringStream << "." << std::endl;
+			return stringStream.str();
+		}
+		else if(command.compare(0, 7, "latency") == 0 || command.compare(0, 3, "lat") == 0)
+		{
+			std::string interfaceId;
+			bool reset = false;
+
+			std::stringstream stream(command);
+			std::string element;
+			int32_t index = 0;
+			while(std::getline(stream, element, ' '))
+			{
+				if(index == 0)
+				{
+					index++;
+					continue;
+				}
+				else if(index == 1)
 				{
 					if(element == "help")
 					{
-						stringStream << "Description: This command searches for new devices." << std::endl;
-						stringStream << "Usage: search" << std::endl << std::endl;
+						stringStream << "Description: This command prints the round trip latencies per request command in microseconds." << std::endl;
+						stringStream << "Usage: latency [INTERFACE] [reset]" << std::endl << std::endl;
 						stringStream << "Parameters:" << std::endl;
-						stringStream << "  There are no parameters." << std::endl;
+						stringStream << "  INTERFACE:\tThe ID of the interface to print the latencies of. Use \"*\" for all interfaces. Default: *" << std::endl;
+						stringStream << "  reset:\tClears the latencies after printing them." << std::endl;
 						return stringStream.str();
 					}
+					if(element != "*") interfaceId = element;
+				}
+				else if(index == 2)
+				{
+					if(element != "reset") return "Invalid parameter.\n";
+					reset = true;
 				}
 				index++;
 			}
 
-			auto result = searchDevices(nullptr, "");
-			stringStream << "Search completed. Found " << result->integerValue64 << " new peers." << std::endl;
+			bool interfaceFound = false;
+			for(auto& interface : GD::physicalInterfaces)
+			{
+				if(!interfaceId.empty() && interface.first != interfaceId) continue;
+				interfaceFound = true;
+				auto latencies = interface.second->getLatencyStatistics();
+				if(reset) interface.second->resetLatencyStatistics();
+				stringStream << "Interface " << interface.first << ":" << std::endl;
+				if(latencies->structValue->empty())
+				{
+					stringStream << "  No requests sent yet." << std::endl;
+					continue;
+				}
+				stringStream << std::left << std::setw(10) << "  Command" << std::setw(34) << "Measurement" << std::right << std::setw(8) << "Count" << std::setw(12) << "Mean" << std::setw(12) << "p50" << std::setw(12) << "p90" << std::setw(12) << "p99" << std::setw(12) << "Max" << std::endl;
+				for(auto& commandLatencies : *latencies->structValue)
+				{
+					for(auto& measurement : *commandLatencies.second->structValue)
+					{
+						auto& values = *measurement.second->structValue;
+						stringStream << std::left << "  " << std::setw(8) << commandLatencies.first << std::setw(34) << measurement.first << std::right << std::setw(8) << values.at("count")->integerValue64
+									 << std::setw(12) << (int64_t)values.at("mean")->floatValue << std::setw(12) << values.at("p50")->integerValue64 << std::setw(12) << values.at("p90")->integerValue64
+									 << std::setw(12) << values.at("p99")->integerValue64 << std::setw(12) << values.at("max")->integerValue64 << std::endl;
+					}
+				}
+			}
+			if(!interfaceFound) return "Unknown interface.\n";
 			return stringStream.str();
 		}
-		else return "Unknown command.\n";
-	}
-	catch(const std::exception& ex)
-    {
-        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
-    }
-    return "Error executing command. See log file for more details.\n";
-}
+		else if(command.compare(0, 7, "metrics") == 0 || command.compare(0, 2, "me") == 0)
+		{
+			std::stringstream stream(command);
+			std::string element;
+			int32_t index = 0;
+			while(std::getline(stream, element, ' '))
+			{
+				if(index == 0)
+				{
+					index++;
+					continue;
+				}
+				else if(index == 1)
+				{
+					if(element == "help")
+					{
+						stringStream << "Description: This command prints the counters and queue depths of the central and all gateways in the Prometheus text format." << std::endl;
+						stringStream << "Usage: metrics" << std::endl << std::endl;
+						stringStream << "Parameters:" << std::endl;
+						stringStream << "  There are no parameters." << std::endl;
+						return stringStream.str();
+					}
+				}
+				index++;
+			}
 
-std::shared_ptr<VeluxPeer> VeluxCentral::createPeer(size_t nodeId, uint8_t firmwareVersion, uint32_t deviceType, const std::string& serialNumber, std::shared_ptr<Klf200> interface, bool save)
-{
-	try
-	{
-		std::shared_ptr<VeluxPeer> peer(new VeluxPeer(_deviceId, this));
-		peer->setAddress(nodeId);
-		peer->setFirmwareVersion(firmwareVersion);
-		peer->setDeviceType(deviceType);
-		peer->setSerialNumber(serialNumber);
-		peer->setRpcDevice(GD::family->getRpcDevices()->find(deviceType, firmwareVersion, -1));
-		if(!peer->getRpcDevice()) return std::shared_ptr<VeluxPeer>();
-		if(save) peer->save(true, true, false); //Save and create peerID
-		peer->setPhysicalInterfaceId(interface->getID());
-		return peer;
-	}
-    catch(const std::exception& ex)
-    {
-    	GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
-    }
-    return std::shared_ptr<VeluxPeer>();
-}
+			return getMetricsText();
+		}
+		else if(command.compare(0, 11, "packettrace") == 0 || command.compare(0, 2, "pt") == 0)
+		{
+			std::string interfaceId;
+			size_t count = 0;
 
-void VeluxCentral::homegearShuttingDown()
-{
-}
+			std::stringstream stream(command);
+			std::string element;
+			int32_t index = 0;
+			while(std::getline(stream, element, ' '))
+			{
+				if(index == 0)
+				{
+					index++;
+					continue;
+				}
+				else if(index == 1)
+				{
+					if(element == "help")
+					{
+						stringStream << "Description: This command prints the last frames sent to and received from the gateways." << std::endl;
+						stringStream << "Usage: packettrace [INTERFACE] [COUNT]" << std::endl << std::endl;
+						stringStream << "Parameters:" << std::endl;
+						stringStream << "  INTERFACE:\tThe ID of the interface to print the frames of. Use \"*\" for all interfaces. Default: *" << std::endl;
+						stringStream << "  COUNT:\tThe maximum number of frames to print per interface. Default: all" << std::endl;
+						return stringStream.str();
+					}
+					if(element != "*") interfaceId = element;
+				}
+				else if(index == 2)
+				{
+					int32_t number = BaseLib::Math::getNumber(element, false);
+					if(number < 0) return "Invalid count.\n";
+					count = number;
+				}
+				index++;
+			}
+
+			bool interfaceFound = false;
+			for(auto& interface : GD::physicalInterfaces)
+			{
+				if(!interfaceId.empty() && interface.first != interfaceId) continue;
+				interfaceFound = true;
+				auto entries = interface.second->getPacketTrace(count);
+				stringStream << "Interface " << interface.first << " (" << entries.size() << " frames):" << std::endl;
+				for(auto& entry : entries)
+				{
+					stringStream << BaseLib::HelperFunctions::getTimeString(entry.time) << (entry.direction == PacketTrace::Direction::sent ? " > " : " < ") << BaseLib::HelperFunctions::getHexString(entry.data) << std::endl;
+				}
+			}
+			if(!interfaceFound) return "Unknown interface.\n";
+			return stringStream.str();
+		}
+		else if(command.compare(0, 10, "stagetrace") == 0 || command.compare(0, 2, "st") == 0)
+		{
+			bool reset = false;
+
+			std::stringstream stream(command);
+			std::string element;
+			int32_t index = 0;
+			while(std::getline(stream, element, ' '))
+			{
+				if(index == 0)
+				{
+					index++;
+					continue;
+				}
+				else if(index == 1)
+				{
+					if(element == "help")
+					{
+						stringStream << "Description: This command prints the time in microseconds received frames spend in each stage of the receive pipeline. Each stage is measured from the end of the previous stage." << std::endl;
+						stringStream << "Usage: stagetrace [on|off|reset]" << std::endl << std::endl;
+						stringStream << "Parameters:" << std::endl;
+						stringStream << "  on:\tEnables stage tracing." << std::endl;
+						stringStream << "  off:\tDisables stage tracing." << std::endl;
+						stringStream << "  reset:\tClears the statistics after printing them." << std::endl;
+						return stringStream.str();
+					}
+					else if(element == "on")
+					{
+						StageTrace::setEnabled(true);
+						return "Stage tracing enabled.\n";
+					}
+					else if(element == "off")
+					{
+						StageTrace::setEnabled(false);
+						return "Stage tracing disabled.\n";
+					}
+					else if(element == "reset") reset = true;
+					else return "Invalid parameter.\n";
+				}
+				index++;
+			}
+
+			auto statistics = _stageTrace.getStatistics();
+			if(reset) _stageTrace.reset();
+			if(!StageTrace::isEnabled()) stringStream << "Stage tracing is disabled. Enable it with \"stagetrace on\"." << std::endl;
+			stringStream << std::left << std::setw(22) << "  Stage" << std::right << std::setw(10) << "Count" << std::setw(12) << "Mean" << std::setw(12) << "p50" << std::setw(12) << "p90" << std::setw(12) << "p99" << std::setw(12) << "Max" << std::endl;
+			for(size_t i = 1; i <= StageTrace::stageCount; i++)
+			{
+				//Print the whole pipeline (index 0) last
+				std::string stageName = StageTrace::getStageName(i % StageTrace::stageCount);
+				auto& values = *statistics->structValue->at(stageName)->structValue;
+				stringStream << std::left << "  " << std::setw(20) << stageName << std::right << std::setw(10) << values.at("count")->integerValue64
+							 << std::setw(12) << (int64_t)values.at("mean")->floatValue << std::setw(12) << values.at("p50")->integerValue64 << std::setw(12) << values.at("p90")->integerValue64
+							 << std::setw(12) << values.at("p99")->integerValue64 << std::setw(12) << values.at("max")->integerValue64 << std::endl;
+			}
+			return stringStream.str();
+		}
+		else if(command.compare(0, 6, "search") == 0 || command.compare(0, 2, "sp") == 0)
+		{
+			std::stringstream stream(command);
+			std::string element;
+			int32_t offset = (command.at(1) == 'p') ? 0 : 1;
+			int32_t index = 0;
+			while(std::getline(stream, element, ' '))
+			{
+				if(index < 1 + offset)
+				{
+					index++;
+					continue;
+				}
+				else if(index == 1 + offset)
+				{
+					if(element == "help")
+					{
+						stringStream << "Description: This command searches for new devices." << std::endl;
+						stringStream << "Usage: search" << std::endl << std::endl;
+						stringStream << "Parameters:" << std::endl;
+						stringStream << "  There are no parameters." << std::endl;
+						return stringStream.str();
+					}
+				}
+				index++;
+			}
+
+			auto result = searchDevices(nullptr, "");
+			stringStream << "Search completed. Found " << result->integerValue64 << " new peers." << std::endl;
+			return stringStream.str();
+		}
+		else return "Unknown command.\n";
+	}
+	catch(const std::exception& ex)
+    {
+        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+    return "Error executing command. See log file for more details.\n";
+}
+
+std::shared_ptr<VeluxPeer> VeluxCentral::createPeer(size_t nodeId, uint8_t firmwareVersion, uint32_t deviceType, const std::string& serialNumber, std::shared_ptr<Klf200> interface, bool save)
+{
+	try
+	{
+		std::shared_ptr<VeluxPeer> peer(new VeluxPeer(_deviceId, this));
+		peer->setMaxParameterStaleness(_maxParameterStaleness);
+		peer->setAddress(nodeId);
+		peer->setFirmwareVersion(firmwareVersion);
+		peer->setDeviceType(deviceType);
+		peer->setSerialNumber(serialNumber);
+		peer->setRpcDevice(GD::family->getRpcDevices()->find(deviceType, firmwareVersion, -1));
+		if(!peer->getRpcDevice()) return std::shared_ptr<VeluxPeer>();
+		if(save) peer->save(true, true, false); //Save and create peerID
+		peer->setPhysicalInterfaceId(interface->getID());
+		return peer;
+	}
+    catch(const std::exception& ex)
+    {
+    	GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+    return std::shared_ptr<VeluxPeer>();
+}
+
+void VeluxCentral::homegearShuttingDown()
+{
+	flushPeerParameters(true);
+}
+
+void VeluxCentral::flushPeerParameters(bool force)
+{
+	try
+	{
+		auto peers = getVeluxPeers();
+		for(auto& peer : peers)
+		{
+			peer->flushParameters(force);
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
+void VeluxCentral::queueMaterialization(uint64_t peerId)
+{
+	try
+	{
+		std::lock_guard<std::mutex> materializationQueueGuard(_materializationQueueMutex);
+		_materializationQueue.push_back(peerId);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
+void VeluxCentral::materializeQueuedPeers()
+{
+	try
+	{
+		std::vector<uint64_t> peerIds;
+		{
+			std::lock_guard<std::mutex> materializationQueueGuard(_materializationQueueMutex);
+			peerIds.swap(_materializationQueue);
+		}
+		for(auto peerId : peerIds)
+		{
+			auto peer = getPeer(peerId);
+			if(peer) peer->materialize();
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
+void VeluxCentral::materializeNextPeer()
+{
+	try
+	{
+		auto peerIndex = _peerIndex.load(std::memory_order_acquire);
+		auto peerIterator = peerIndex->peersById.upper_bound(_lastMaterializedPeerId);
+		if(peerIterator == peerIndex->peersById.end())
+		{
+			_backgroundMaterializationFinished = true;
+			GD::out.printInfo("Info: All peers are loaded completely.");
+			return;
+		}
+		_lastMaterializedPeerId = peerIterator->first;
+		peerIterator->second->materialize();
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
+void VeluxCentral::worker()
+{
+	try
+	{
+		int64_t lastFlush = BaseLib::HelperFunctions::getTime();
+		int64_t lastMetricsWrite = 0;
+		while(!_stopWorkerThread)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			if(_stopWorkerThread) return;
+
+			try
+			{
+				reclaimDeletedPeers();
+				if(_lazyPeerLoading)
+				{
+					materializeQueuedPeers();
+					if(_peersLoaded && !_backgroundMaterializationFinished) materializeNextPeer();
+				}
+
+				int64_t time = BaseLib::HelperFunctions::getTime();
+				if(_maxParameterStaleness > 0 && time - lastFlush >= std::min(_maxParameterStaleness, (int64_t)1000))
+				{
+					lastFlush = time;
+					flushPeerParameters(false);
+				}
+
+				if(!_metricsFile.empty() && time - lastMetricsWrite >= _metricsInterval)
+				{
+					lastMetricsWrite = time;
+					writeMetricsFile();
+				}
+			}
+			catch(const std::exception& ex)
+			{
+				GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+			}
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
 
 //RPC functions
 PVariable VeluxCentral::deleteDevice(BaseLib::PRpcClientInfo clientInfo, std::string serialNumber, int32_t flags)
@@ -760,17 +1387,370 @@ PVariable VeluxCentral::getPairingState(BaseLib::PRpcClientInfo clientInfo)
     return Variable::createError(-32500, "Unknown application error.");
 }
 
+PVariable VeluxCentral::getLatencyStatistics(const PRpcClientInfo& clientInfo, const PArray& parameters)
+{
+	try
+	{
+		if(parameters->size() > 2) return Variable::createError(-1, "Wrong parameter count.");
+		if(!parameters->empty() && parameters->at(0)->type != VariableType::tString) return Variable::createError(-1, "Parameter 1 is not of type String.");
+		if(parameters->size() == 2 && parameters->at(1)->type != VariableType::tBoolean) return Variable::createError(-1, "Parameter 2 is not of type Boolean.");
+
+		std::string interfaceId = parameters->empty() ? "" : parameters->at(0)->stringValue;
+		bool reset = parameters->size() == 2 && parameters->at(1)->booleanValue;
+
+		auto result = std::make_shared<Variable>(VariableType::tStruct);
+		for(auto& interface : GD::physicalInterfaces)
+		{
+			if(!interfaceId.empty() && interface.first != interfaceId) continue;
+			result->structValue->emplace(interface.first, interface.second->getLatencyStatistics());
+			if(reset) interface.second->resetLatencyStatistics();
+		}
+		if(!interfaceId.empty() && result->structValue->empty()) return Variable::createError(-2, "Unknown interface.");
+		return result;
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxCentral::getStageLatencies(const PRpcClientInfo& clientInfo, const PArray& parameters)
+{
+	try
+	{
+		if(parameters->size() > 1) return Variable::createError(-1, "Wrong parameter count.");
+		if(!parameters->empty() && parameters->at(0)->type != VariableType::tBoolean) return Variable::createError(-1, "Parameter 1 is not of type Boolean.");
+
+		auto result = std::make_shared<Variable>(VariableType::tStruct);
+		result->structValue->emplace("enabled", std::make_shared<Variable>(StageTrace::isEnabled()));
+		result->structValue->emplace("stages", _stageTrace.getStatistics());
+		if(!parameters->empty() && parameters->at(0)->booleanValue) _stageTrace.reset();
+		return result;
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxCentral::getMetrics(const PRpcClientInfo& clientInfo, const PArray& parameters)
+{
+	try
+	{
+		if(!parameters->empty()) return Variable::createError(-1, "Wrong parameter count.");
+
+		auto peers = getVeluxPeers();
+		size_t dirtyParameters = 0;
+		for(auto& peer : peers)
+		{
+			dirtyParameters += peer->getDirtyParameterCount();
+		}
+
+		auto centralMetrics = std::make_shared<Variable>(VariableType::tStruct);
+		centralMetrics->structValue->emplace("droppedUnknownNodeFrames", std::make_shared<Variable>((int64_t)_droppedUnknownNodeFrames.load()));
+		centralMetrics->structValue->emplace("eventsRaised", std::make_shared<Variable>((int64_t)_eventsRaised.load()));
+		centralMetrics->structValue->emplace("peers", std::make_shared<Variable>((int64_t)peers.size()));
+		centralMetrics->structValue->emplace("dirtyParameters", std::make_shared<Variable>((int64_t)dirtyParameters));
+
+		auto interfaceMetrics = std::make_shared<Variable>(VariableType::tStruct);
+		for(auto& interface : GD::physicalInterfaces)
+		{
+			interfaceMetrics->structValue->emplace(interface.first, interface.second->getMetrics());
+		}
+
+		auto result = std::make_shared<Variable>(VariableType::tStruct);
+		result->structValue->emplace("central", centralMetrics);
+		result->structValue->emplace("interfaces", interfaceMetrics);
+		return result;
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxCentral::setValues(const PRpcClientInfo& clientInfo, const PArray& parameters)
+{
+	try
+	{
+		if(parameters->size() != 1) return Variable::createError(-1, "Wrong parameter count.");
+		if(parameters->at(0)->type != VariableType::tArray) return Variable::createError(-1, "Parameter 1 is not of type Array.");
+
+		//Layout of GW_COMMAND_SEND_REQ
+		const size_t indexArrayCountByte = 41;
+		const size_t indexArrayByte = 42;
+		const size_t maxNodesPerFrame = 20;
+
+		struct BatchedFrame
+		{
+			std::shared_ptr<Klf200> interface;
+			PVeluxPacket packet;
+			std::vector<uint8_t> nodeIds;
+			//Indexes of the entries sent with this frame
+			std::vector<size_t> entries;
+		};
+
+		auto& entries = *parameters->at(0)->arrayValue;
+		auto results = std::make_shared<Variable>(VariableType::tArray);
+		results->arrayValue->reserve(entries.size());
+		std::vector<BatchedFrame> frames;
+		//Frames which can still take more nodes. The key is the interface ID and the payload without session ID and nodes.
+		std::map<std::pair<std::string, std::vector<uint8_t>>, size_t> openFrames;
+
+		for(size_t i = 0; i < entries.size(); i++)
+		{
+			auto& entry = entries.at(i);
+			if(entry->type != VariableType::tArray || entry->arrayValue->size() != 4)
+			{
+				results->arrayValue->push_back(Variable::createError(-1, "Entry is not an array of peer ID, channel, value key and value."));
+				continue;
+			}
+
+			uint64_t peerId = (uint64_t)entry->arrayValue->at(0)->integerValue64;
+			int32_t channel = entry->arrayValue->at(1)->integerValue;
+			std::string valueKey = entry->arrayValue->at(2)->stringValue;
+			auto peer = getPeer(peerId);
+			if(!peer)
+			{
+				results->arrayValue->push_back(Variable::createError(-2, "Unknown device."));
+				continue;
+			}
+			if(!clientInfo->acls->checkVariableWriteAccess(peer, channel, valueKey))
+			{
+				results->arrayValue->push_back(Variable::createError(-32603, "Unauthorized."));
+				continue;
+			}
+
+			std::vector<PVeluxPacket> packets;
+			auto result = peer->setValue(clientInfo, channel, valueKey, entry->arrayValue->at(3), false, &packets);
+			results->arrayValue->push_back(result);
+			if(result->errorStruct) continue;
+
+			auto& interface = peer->getPhysicalInterface();
+			for(auto& packet : packets)
+			{
+				auto& payload = packet->getPayload();
+				bool combinable = packet->getCommand() == VeluxCommand::GW_COMMAND_SEND_REQ && payload.size() >= indexArrayByte + maxNodesPerFrame && payload.at(indexArrayCountByte) == 1;
+				std::pair<std::string, std::vector<uint8_t>> key;
+				if(combinable)
+				{
+					key.first = interface->getID();
+					key.second = payload;
+					key.second.at(0) = 0;
+					key.second.at(1) = 0;
+					key.second.at(indexArrayByte) = 0;
+
+					uint8_t nodeId = payload.at(indexArrayByte);
+					auto openFrameIterator = openFrames.find(key);
+					if(openFrameIterator != openFrames.end())
+					{
+						auto& frame = frames.at(openFrameIterator->second);
+						if(std::find(frame.nodeIds.begin(), frame.nodeIds.end(), nodeId) == frame.nodeIds.end())
+						{
+							frame.nodeIds.push_back(nodeId);
+							frame.entries.push_back(i);
+							if(frame.nodeIds.size() == maxNodesPerFrame) openFrames.erase(openFrameIterator);
+							continue;
+						}
+					}
+				}
+
+				BatchedFrame frame;
+				frame.interface = interface;
+				frame.packet = packet;
+				if(combinable) frame.nodeIds.push_back(payload.at(indexArrayByte));
+				frame.entries.push_back(i);
+				frames.push_back(std::move(frame));
+				if(combinable) openFrames[key] = frames.size() - 1;
+			}
+		}
+
+		for(auto& frame : frames)
+		{
+			if(frame.nodeIds.size() > 1)
+			{
+				std::vector<uint8_t> payload = frame.packet->getPayload();
+				payload.at(indexArrayCountByte) = (uint8_t)frame.nodeIds.size();
+				std::copy(frame.nodeIds.begin(), frame.nodeIds.end(), payload.begin() + indexArrayByte);
+				frame.packet = std::make_shared<VeluxPacket>(VeluxCommand::GW_COMMAND_SEND_REQ, payload);
+				frame.packet->setPosition(0, 16, (uint32_t)frame.interface->getMessageCounter());
+			}
+
+			auto response = frame.interface->sendRequest(frame.packet);
+			if(response && response->getPayload().size() >= 3 && response->getPayload().at(2) == 1) continue;
+			for(auto entry : frame.entries)
+			{
+				results->arrayValue->at(entry) = Variable::createError(-32500, response ? "The command was rejected by the KLF200." : "No confirmation was received from the KLF200.");
+			}
+		}
+
+		return results;
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+std::string VeluxCentral::getMetricsText()
+{
+	try
+	{
+		auto metrics = getMetrics(PRpcClientInfo(), std::make_shared<Array>());
+		if(metrics->errorStruct) return "";
+
+		static const std::unordered_set<std::string> gauges{"peers", "dirtyParameters", "pendingRequests", "pendingSessions"};
+
+		//The exposition format requires all samples of a metric to be grouped, so they are collected first.
+		std::map<std::string, std::vector<std::string>> samplesByMetric;
+		auto addSample = [&](const std::string& key, const std::string& labels, const PVariable& value)
+		{
+			std::string name = "velux_klf200_";
+			for(char c : key)
+			{
+				if(std::isupper(c))
+				{
+					name.push_back('_');
+					name.push_back(std::tolower(c));
+				}
+				else name.push_back(c);
+			}
+			if(gauges.find(key) == gauges.end()) name.append("_total");
+			samplesByMetric[name].push_back(name + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(value->integerValue64));
+		};
+
+		for(auto& element : *metrics->structValue->at("central")->structValue)
+		{
+			addSample(element.first, "", element.second);
+		}
+
+		for(auto& interface : *metrics->structValue->at("interfaces")->structValue)
+		{
+			if(interface.second->errorStruct) continue;
+			std::string interfaceLabel = "interface=\"";
+			for(char c : interface.first)
+			{
+				if(c == '"' || c == '\\') interfaceLabel.push_back('\\');
+				interfaceLabel.push_back(c);
+			}
+			interfaceLabel.push_back('"');
+
+			for(auto& element : *interface.second->structValue)
+			{
+				if(element.second->type == VariableType::tStruct)
+				{
+					for(auto& commandElement : *element.second->structValue)
+					{
+						addSample(element.first, interfaceLabel + ",command=\"" + commandElement.first + "\"", commandElement.second);
+					}
+				}
+				else addSample(element.first, interfaceLabel, element.second);
+			}
+		}
+
+		std::ostringstream stringStream;
+		for(auto& metric : samplesByMetric)
+		{
+			stringStream << "# TYPE " << metric.first << (metric.first.compare(metric.first.size() - 6, 6, "_total") == 0 ? " counter" : " gauge") << std::endl;
+			for(auto& sample : metric.second)
+			{
+				stringStream << sample << std::endl;
+			}
+		}
+		return stringStream.str();
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return "";
+}
+
+void VeluxCentral::writeMetricsFile()
+{
+	try
+	{
+		std::string temporaryFile = _metricsFile + ".tmp";
+		{
+			std::ofstream file(temporaryFile, std::ios::out | std::ios::trunc);
+			if(!file)
+			{
+				GD::out.printError("Error: Could not open metrics file " + temporaryFile);
+				return;
+			}
+			file << getMetricsText();
+		}
+		if(std::rename(temporaryFile.c_str(), _metricsFile.c_str()) != 0) GD::out.printError("Error: Could not write metrics file " + _metricsFile);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
 PVariable VeluxCentral::searchDevices(BaseLib::PRpcClientInfo clientInfo, const std::string& interfaceId)
 {
 	try
 	{
         std::lock_guard<std::mutex> searchDevicesGuard(_searchDevicesMutex);
-        std::unordered_set<std::shared_ptr<VeluxPeer>> newPeers;
+
+        //{{{ Enumerate all gateways at the same time, so the search takes as long as the slowest gateway.
+        struct EnumerationResult
+        {
+            std::list<PVeluxPacket> nodeInfo;
+            std::list<PVeluxPacket> sceneInfo;
+        };
+
+        std::mutex resultsMutex;
+        std::condition_variable resultsConditionVariable;
+        size_t pendingRequests = 0;
+        std::unordered_map<std::string, EnumerationResult> results;
         for(auto& interface : GD::physicalInterfaces)
         {
             if(!interfaceId.empty() && interface.first != interfaceId) continue;
+            if(interface.second->isReplayInterface()) continue;
+            results.emplace(interface.first, EnumerationResult());
+            pendingRequests += 2;
+        }
+        for(auto& interface : GD::physicalInterfaces)
+        {
+            if(results.find(interface.first) == results.end()) continue;
+            const std::string& id = interface.first;
+            //Both requests are queued right away. The interface sends them one after another.
+            interface.second->getNodeInfoAsync().start([&, id](std::list<PVeluxPacket> nodeInfo)
+            {
+                std::lock_guard<std::mutex> resultsGuard(resultsMutex);
+                results.at(id).nodeInfo = std::move(nodeInfo);
+                pendingRequests--;
+                resultsConditionVariable.notify_one();
+            });
+            interface.second->getSceneInfoAsync().start([&, id](std::list<PVeluxPacket> sceneInfo)
+            {
+                std::lock_guard<std::mutex> resultsGuard(resultsMutex);
+                results.at(id).sceneInfo = std::move(sceneInfo);
+                pendingRequests--;
+                resultsConditionVariable.notify_one();
+            });
+        }
+        {
+            std::unique_lock<std::mutex> resultsGuard(resultsMutex);
+            resultsConditionVariable.wait(resultsGuard, [&] { return pendingRequests == 0; });
+        }
+        //}}}
 
-            auto nodeInfoList = interface.second->getNodeInfo();
+        std::unordered_set<std::shared_ptr<VeluxPeer>> newPeers;
+        //The peer index is published once after all peers are added, so getPeer() doesn't know the new peers yet.
+        std::unordered_set<std::string> newSerialNumbers;
+        for(auto& interface : GD::physicalInterfaces)
+        {
+            auto resultIterator = results.find(interface.first);
+            if(resultIterator == results.end()) continue;
+
+            auto& nodeInfoList = resultIterator->second.nodeInfo;
 
             for(auto& info : nodeInfoList)
             {
@@ -787,7 +1767,7 @@ PVariable VeluxCentral::searchDevices(BaseLib::PRpcClientInfo clientInfo, const
                 std::string serialNumber = BaseLib::HelperFunctions::getHexString(payload.data() + 76, 8);
 
                 auto peer = getPeer(serialNumber);
-                if(peer) continue;
+                if(peer || newSerialNumbers.find(serialNumber) != newSerialNumbers.end()) continue;
 
                 peer = createPeer(nodeId, firmwareVersion, nodeTypeSubType, serialNumber, interface.second, true);
                 if(!peer)
@@ -803,51 +1783,68 @@ PVariable VeluxCentral::searchDevices(BaseLib::PRpcClientInfo clientInfo, const
                     std::lock_guard<std::mutex> peersGuard(_peersMutex);
                     _peersBySerial[serialNumber] = peer;
                     _peersById[peer->getID()] = peer;
-                    _peersByInterface[interface.first][nodeId] = peer;
+                    setNodePeer(interface.first, nodeId, peer);
                 }
+                newSerialNumbers.emplace(serialNumber);
 
                 GD::out.printMessage("Added peer " + std::to_string(peer->getID()) + ".");
                 newPeers.emplace(std::move(peer));
             }
 
-            auto sceneInfoList = interface.second->getSceneInfo();
+            auto& sceneInfoList = resultIterator->second.sceneInfo;
 
             for(auto& info : sceneInfoList)
             {
-                auto payload = info->getPayload();
+                //NumberOfObject, then SceneID (1 byte) and Name (64 bytes) for each scene, then RemainingNumberOfObject
+                auto& payload = info->getPayload();
                 if(payload.size() < 2) continue;
 
-                uint32_t deviceType = 0x80000000;
-                uint8_t firmwareVersion = 0x10;
-                std::string serialNumber = "*" + std::string();
-
-                auto peer = getPeer(serialNumber);
-                if(peer) continue;
-
-                /*peer = createPeer(nodeId, firmwareVersion, nodeTypeSubType, serialNumber, interface.second, true);
-                if(!peer)
+                size_t sceneCount = payload.at(0);
+                if(payload.size() < 2 + sceneCount * 65) continue;
+                for(size_t i = 0; i < sceneCount; i++)
                 {
-                    GD::out.printWarning("Warning: No matching XML file found for device with serialnumber " + serialNumber + ". Type ID: 0x" + BaseLib::HelperFunctions::getHexString(nodeTypeSubType) + ".");
-                    continue;
-                }
-                if(peer->getID() == 0) continue;
+                    size_t offset = 1 + i * 65;
+                    uint8_t sceneId = payload.at(offset);
+                    auto nameBegin = payload.begin() + offset + 1;
+                    std::string name(nameBegin, std::find(nameBegin, nameBegin + 64, 0));
+                    uint32_t deviceType = 0x80000000;
+                    uint8_t firmwareVersion = 0x10;
+                    //Scene IDs are only unique per KLF200
+                    std::string serialNumber = "*" + interface.first + "-" + BaseLib::HelperFunctions::getHexString(sceneId, 2);
+
+                    auto peer = getPeer(serialNumber);
+                    if(peer || newSerialNumbers.find(serialNumber) != newSerialNumbers.end()) continue;
+
+                    peer = createPeer(sceneId, firmwareVersion, deviceType, serialNumber, interface.second, true);
+                    if(!peer)
+                    {
+                        GD::out.printWarning("Warning: No matching XML file found for scene " + serialNumber + ". Type ID: 0x" + BaseLib::HelperFunctions::getHexString(deviceType) + ".");
+                        continue;
+                    }
+                    if(peer->getID() == 0) continue;
 
-                peer->setName(name);
+                    peer->setName(name);
 
-                {
-                    std::lock_guard<std::mutex> peersGuard(_peersMutex);
-                    _peersBySerial[serialNumber] = peer;
-                    _peersById[peer->getID()] = peer;
-                    _peersByInterface[interface.first][nodeId] = peer;
-                }
+                    {
+                        std::lock_guard<std::mutex> peersGuard(_peersMutex);
+                        _peersBySerial[serialNumber] = peer;
+                        _peersById[peer->getID()] = peer;
+                    }
+                    newSerialNumbers.emplace(serialNumber);
 
-                GD::out.printMessage("Added peer " + std::to_string(peer->getID()) + ".");
-                newPeers.emplace(std::move(peer));*/
+                    GD::out.printMessage("Added scene peer " + std::to_string(peer->getID()) + ".");
+                    newPeers.emplace(std::move(peer));
+                }
             }
         }
 
         if(!newPeers.empty())
         {
+            {
+                std::lock_guard<std::mutex> peersGuard(_peersMutex);
+                publishPeers();
+            }
+
             std::vector<uint64_t> newIds;
             newIds.reserve(newPeers.size());
             PVariable deviceDescriptions = std::make_shared<BaseLib::Variable>(BaseLib::VariableType::tArray);
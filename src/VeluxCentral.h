@@ -36,9 +36,12 @@
 #include "VeluxPeer.h"
 #include "VeluxPacket.h"
 
+#include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 
 namespace Velux
 {
@@ -76,6 +79,54 @@ public:
 	virtual PVariable deleteDevice(BaseLib::PRpcClientInfo clientInfo, uint64_t peerID, int32_t flags);
     virtual PVariable getPairingState(BaseLib::PRpcClientInfo clientInfo);
 	virtual PVariable searchDevices(BaseLib::PRpcClientInfo clientInfo, const std::string& interfaceId);
+
+	//{{{ Family RPC methods
+	/**
+	 * RPC method "getLatencyStatistics". Returns the round trip latencies per interface and request command.
+	 *
+	 * Parameters: [String interfaceId] [Boolean reset]. An empty interface ID returns all interfaces.
+	 */
+	PVariable getLatencyStatistics(const PRpcClientInfo& clientInfo, const PArray& parameters);
+
+	/**
+	 * RPC method "getMetrics". Returns the counters and queue depths of the central and all interfaces.
+	 */
+	PVariable getMetrics(const PRpcClientInfo& clientInfo, const PArray& parameters);
+
+	/**
+	 * RPC method "getStageLatencies". Returns the time received frames spend in each stage of the receive pipeline.
+	 *
+	 * Parameters: [Boolean reset]
+	 */
+	PVariable getStageLatencies(const PRpcClientInfo& clientInfo, const PArray& parameters);
+
+	/**
+	 * RPC method "setValues". Sets values of several peers at once. Frames of peers on the same KLF200 that only
+	 * differ in the node are combined into one GW_COMMAND_SEND_REQ with up to 20 nodes.
+	 *
+	 * Parameters: Array entries. Each entry is an array of [Integer peerId, Integer channel, String valueKey, Variant value].
+	 * Returns an array with the result of each entry in the same order.
+	 */
+	PVariable setValues(const PRpcClientInfo& clientInfo, const PArray& parameters);
+	//}}}
+
+	/**
+	 * Returns the metrics in the Prometheus text exposition format.
+	 */
+	std::string getMetricsText();
+
+	/**
+	 * Counts values sent to clients as events. Called by the peers.
+	 */
+	void countRaisedEvents(size_t count) { _eventsRaised += count; }
+
+	/**
+	 * Makes the worker thread materialize a lazily loaded peer which received a packet. Called by the peers, which
+	 * defer the packet until then.
+	 */
+	void queueMaterialization(uint64_t peerId);
+
+	StageTrace& getStageTrace() { return _stageTrace; }
 protected:
 	//In table variables
 	int32_t _firmwareVersion = 0;
@@ -85,7 +136,85 @@ protected:
 
 	std::mutex _searchDevicesMutex;
 
-	std::unordered_map<std::string, std::unordered_map<size_t, std::shared_ptr<VeluxPeer>>> _peersByInterface;
+	/**
+	 * Peers of one interface indexed by node ID. KLF200 node IDs are a single byte.
+	 */
+	struct NodeTable
+	{
+		std::array<std::atomic<std::shared_ptr<VeluxPeer>>, 256> peers;
+	};
+	typedef std::unordered_map<std::string, std::shared_ptr<NodeTable>> NodeTables;
+
+	//Node tables by interface ID. The map is never modified after publishing (tables are added by copying it), so the
+	//packet path reads it without locking.
+	std::atomic<std::shared_ptr<const NodeTables>> _nodeTables;
+
+	/**
+	 * Immutable copy of "_peersById" and "_peersBySerial". Lookups and listings read it without locking "_peersMutex".
+	 */
+	struct PeerIndex
+	{
+		std::map<uint64_t, std::shared_ptr<VeluxPeer>> peersById;
+		std::unordered_map<std::string, std::shared_ptr<VeluxPeer>> peersBySerial;
+	};
+
+	//Replaced as a whole by publishPeers() whenever peers are added or removed.
+	std::atomic<std::shared_ptr<const PeerIndex>> _peerIndex;
+
+	//{{{ Peer deletion
+	/**
+	 * IDs of peers removed by deletePeer() that are not referenced anymore. Filled by the destructor of the peers. Shared
+	 * with the peers, because a deleted peer might outlive the central.
+	 */
+	struct DeletedPeers
+	{
+		std::mutex mutex;
+		std::vector<uint64_t> peerIds;
+		//Set by dispose(). Peers destroyed afterwards are deleted from the database directly.
+		bool disposed = false;
+	};
+
+	std::shared_ptr<DeletedPeers> _deletedPeers = std::make_shared<DeletedPeers>();
+	//}}}
+
+	struct PeerToLoad
+	{
+		uint64_t peerId = 0;
+		size_t nodeId = 0;
+		std::string serialNumber;
+		//Set by loadPeersThread() when loading was successful.
+		std::shared_ptr<VeluxPeer> peer;
+	};
+
+	std::atomic_bool _stopWorkerThread{false};
+	std::thread _workerThread;
+
+	//Family setting "maxParameterStaleness" in milliseconds
+	int64_t _maxParameterStaleness = 5000;
+
+	//{{{ Lazy peer loading
+	//Family setting "lazyPeerLoading"
+	bool _lazyPeerLoading = false;
+	//Set by loadPeers() after the peer index is published. The worker thread is started before, so it must not
+	//materialize peers (or consider materialization finished) before this is set.
+	std::atomic_bool _peersLoaded{false};
+	//IDs of peers which received packets before they were materialized
+	std::mutex _materializationQueueMutex;
+	std::vector<uint64_t> _materializationQueue;
+	//Only used by the worker thread. ID of the last peer materialized in the background.
+	uint64_t _lastMaterializedPeerId = 0;
+	bool _backgroundMaterializationFinished = false;
+	//}}}
+
+	//{{{ Metrics
+	std::atomic<uint64_t> _droppedUnknownNodeFrames{0};
+	std::atomic<uint64_t> _eventsRaised{0};
+	//Family settings "metricsFile" and "metricsInterval" (in milliseconds)
+	std::string _metricsFile;
+	int64_t _metricsInterval = 10000;
+	//}}}
+
+	StageTrace _stageTrace;
 
 	/**
 	 * Creates a new peer. The method does not add the peer to the peer arrays.
@@ -100,7 +229,64 @@ protected:
 	std::shared_ptr<VeluxPeer> createPeer(size_t nodeId, uint8_t firmwareVersion, uint32_t deviceType, const std::string& serialNumber, std::shared_ptr<Klf200> interface, bool save = true);
 	void deletePeer(uint64_t id);
 
+	/**
+	 * Deletes the peers removed by deletePeer() from the database once they were destroyed.
+	 */
+	void reclaimDeletedPeers();
+
+	/**
+	 * Sets the peer of a node ID in the node table of the interface. Needs to be called with "_peersMutex" locked.
+	 */
+	void setNodePeer(const std::string& interfaceId, size_t nodeId, const std::shared_ptr<VeluxPeer>& peer);
+
+	/**
+	 * Clears the node table entry of "peer" if it still points to it. Needs to be called with "_peersMutex" locked.
+	 */
+	void removeNodePeer(const std::string& interfaceId, size_t nodeId, const std::shared_ptr<VeluxPeer>& peer);
+
+	/**
+	 * Rebuilds the peer index from "_peersById" and "_peersBySerial" and publishes it. Needs to be called with
+	 * "_peersMutex" locked after changing the peer maps.
+	 */
+	void publishPeers();
+
+	std::vector<std::shared_ptr<VeluxPeer>> getVeluxPeers();
+
+	/**
+	 * Writes buffered parameter changes of all peers to the database.
+	 *
+	 * @param force When "false", only peers with changes older than the maximum staleness are written.
+	 */
+	void flushPeerParameters(bool force);
+
+	/**
+	 * Materializes the next lazily loaded peer. Called by the worker thread after loadPeers() finished until all peers
+	 * are materialized. Not all methods of Peer accessing the parameters can be overridden (e.g. the assignment of
+	 * rooms and categories), so lazy loading only defers loading the parameters until after the startup.
+	 */
+	void materializeNextPeer();
+
+	/**
+	 * Materializes the peers queued by queueMaterialization(). Called by the worker thread.
+	 */
+	void materializeQueuedPeers();
+
+	/**
+	 * Writes getMetricsText() to the file set in "metricsFile". The file is replaced atomically, so readers never
+	 * see a partially written file.
+	 */
+	void writeMetricsFile();
+
+	/**
+	 * Loads peers from "peers" until all are taken. Run by several threads in parallel during loadPeers().
+	 *
+	 * @param peers The peers to load. Each element is only written by the thread which took it.
+	 * @param nextPeer Index of the next element of "peers" to load.
+	 */
+	void loadPeersThread(std::vector<PeerToLoad>* peers, std::atomic<size_t>* nextPeer);
+
 	void init();
+	void worker();
 };
 
 }
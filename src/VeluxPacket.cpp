@@ -32,6 +32,8 @@
 #include "VeluxPacket.h"
 #include "GD.h"
 
+#include <cstring>
+
 namespace Velux
 {
 
@@ -99,18 +101,18 @@ VeluxPacket::VeluxPacket(const std::vector<uint8_t>& binaryPacket)
 {
     _binaryPacket = binaryPacket;
 
-    if(binaryPacket.size() < 4) throw InvalidVeluxPacketException("Packet too small");
+    if(binaryPacket.size() < 4) throw InvalidVeluxPacketException("Packet too small", InvalidVeluxPacketException::Reason::length);
     if(binaryPacket.at(0) != 0) throw InvalidVeluxPacketException("Invalid ProtocolID");
 
     _length = binaryPacket.at(1);
-    if(binaryPacket.size() - 2 != _length) throw InvalidVeluxPacketException("Invalid length byte");
+    if(binaryPacket.size() - 2 != _length) throw InvalidVeluxPacketException("Invalid length byte", InvalidVeluxPacketException::Reason::length);
 
     uint8_t checksum = binaryPacket[0];
     for(int32_t i = 1; i < (signed)binaryPacket.size() - 1; i++)
     {
         checksum ^= binaryPacket[i];
     }
-    if(checksum != binaryPacket.back()) throw InvalidVeluxPacketException("Invalid checksum");
+    if(checksum != binaryPacket.back()) throw InvalidVeluxPacketException("Invalid checksum", InvalidVeluxPacketException::Reason::checksum);
 
     _command = (VeluxCommand)((((uint16_t)binaryPacket[2]) << 8) | binaryPacket[3]);
     if(binaryPacket.size() > 5) _payload = std::vector<uint8_t>(binaryPacket.begin() + 4, binaryPacket.end() - 1);
@@ -129,6 +131,23 @@ VeluxCommand VeluxPacket::getResponseCommand()
     return VeluxCommand::UNSET;
 }
 
+std::vector<VeluxCommand> VeluxPacket::getRequestCommands()
+{
+    std::vector<VeluxCommand> requestCommands;
+    requestCommands.reserve(_requestResponseMapping.size());
+    for(auto& element : _requestResponseMapping)
+    {
+        requestCommands.push_back(element.first);
+    }
+    return requestCommands;
+}
+
+void VeluxPacket::setStageTime(StageTrace::Stage stage, int64_t time)
+{
+    if(!_stageTimes) _stageTimes = std::make_unique<StageTrace::StageTimes>();
+    (*_stageTimes)[(size_t)stage] = time;
+}
+
 void VeluxPacket::reset()
 {
     _binaryPacket.clear();
@@ -210,6 +229,10 @@ std::vector<uint8_t> VeluxPacket::getPosition(uint32_t position, uint32_t size)
 {
     try
     {
+        if(isByteAligned(position, size) && (position >> 3) + (size >> 3) <= _payload.size())
+        {
+            return std::vector<uint8_t>(_payload.begin() + (position >> 3), _payload.begin() + (position >> 3) + (size >> 3));
+        }
         return BaseLib::BitReaderWriter::getPosition(_payload, position, size);
     }
     catch(const std::exception& ex)
@@ -219,10 +242,40 @@ std::vector<uint8_t> VeluxPacket::getPosition(uint32_t position, uint32_t size)
     return std::vector<uint8_t>();
 }
 
+int32_t VeluxPacket::getPositionInteger(uint32_t position, uint32_t size)
+{
+    try
+    {
+        if(isByteAligned(position, size) && size <= 32 && (position >> 3) + (size >> 3) <= _payload.size())
+        {
+            uint32_t value = 0;
+            for(uint32_t i = position >> 3; i < (position >> 3) + (size >> 3); i++)
+            {
+                value = (value << 8) | _payload[i];
+            }
+            return (int32_t)value;
+        }
+        int32_t value = 0;
+        GD::bl->hf.memcpyBigEndian(value, BaseLib::BitReaderWriter::getPosition(_payload, position, size));
+        return value;
+    }
+    catch(const std::exception& ex)
+    {
+        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+    return 0;
+}
+
 void VeluxPacket::setPosition(uint32_t position, uint32_t size, const std::vector<uint8_t>& source)
 {
     try
     {
+        if(isByteAligned(position, size))
+        {
+            setBytes(_payload, position >> 3, size >> 3, source.data(), source.size());
+            return;
+        }
+
         std::vector<uint8_t> sourceCopy;
         sourceCopy.reserve(source.size());
         for(int32_t i = source.size() - 1; i >= 0; i--)
@@ -237,4 +290,46 @@ void VeluxPacket::setPosition(uint32_t position, uint32_t size, const std::vecto
     }
 }
 
+void VeluxPacket::setPosition(uint32_t position, uint32_t size, uint32_t value)
+{
+    try
+    {
+        if(isByteAligned(position, size))
+        {
+            setBytes(_payload, position >> 3, size >> 3, value);
+            return;
+        }
+
+        std::vector<uint8_t> source;
+        GD::bl->hf.memcpyBigEndian(source, (int32_t)value);
+        setPosition(position, size, source);
+    }
+    catch(const std::exception& ex)
+    {
+        GD::bl->out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+}
+
+void VeluxPacket::setBytes(std::vector<uint8_t>& target, uint32_t index, uint32_t size, const uint8_t* source, uint32_t sourceSize)
+{
+    if(target.size() < index + size) target.resize(index + size, 0);
+    uint8_t* targetData = target.data() + index;
+    if(sourceSize >= size) std::memcpy(targetData, source + (sourceSize - size), size);
+    else
+    {
+        std::memset(targetData, 0, size - sourceSize);
+        if(sourceSize > 0) std::memcpy(targetData + (size - sourceSize), source, sourceSize);
+    }
+}
+
+void VeluxPacket::setBytes(std::vector<uint8_t>& target, uint32_t index, uint32_t size, uint32_t value)
+{
+    if(target.size() < index + size) target.resize(index + size, 0);
+    for(int32_t i = (signed)size - 1; i >= 0; i--)
+    {
+        target[index + i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
 }
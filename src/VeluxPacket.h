@@ -32,6 +32,8 @@
 
 #include <cstdint>
 
+#include "StageTrace.h"
+
 #include <homegear-base/BaseLib.h>
 
 #include <map>
@@ -44,7 +46,18 @@ namespace Velux
 class InvalidVeluxPacketException : public BaseLib::Exception
 {
 public:
-    explicit InvalidVeluxPacketException(const std::string& message) : Exception(message) {}
+    enum class Reason
+    {
+        other,
+        length,
+        checksum
+    };
+
+    explicit InvalidVeluxPacketException(const std::string& message, Reason reason = Reason::other) : Exception(message), _reason(reason) {}
+
+    Reason getReason() const { return _reason; }
+private:
+    Reason _reason = Reason::other;
 };
 
 enum class VeluxCommand : uint16_t
@@ -216,13 +229,39 @@ public:
 
     VeluxCommand getResponseCommand();
 
+    /**
+     * Returns all commands a confirmation is expected for.
+     */
+    static std::vector<VeluxCommand> getRequestCommands();
+
     VeluxCommand getCommand() { return _command; }
     int32_t getNodeId() { return _nodeId; }
-    std::vector<uint8_t> getPayload() { return _payload; }
+    const std::vector<uint8_t>& getPayload() { return _payload; }
     std::vector<uint8_t> getBinary();
 
     std::vector<uint8_t> getPosition(uint32_t position, uint32_t size);
+    int32_t getPositionInteger(uint32_t position, uint32_t size);
     void setPosition(uint32_t position, uint32_t size, const std::vector<uint8_t>& source);
+    void setPosition(uint32_t position, uint32_t size, uint32_t value);
+
+    static bool isByteAligned(uint32_t position, uint32_t size) { return size > 0 && (position & 7) == 0 && (size & 7) == 0; }
+
+    /**
+     * Writes "source" right-aligned and in big endian byte order into the "size" bytes of "target" starting at
+     * "index". "target" is enlarged if necessary.
+     */
+    static void setBytes(std::vector<uint8_t>& target, uint32_t index, uint32_t size, const uint8_t* source, uint32_t sourceSize);
+    static void setBytes(std::vector<uint8_t>& target, uint32_t index, uint32_t size, uint32_t value);
+
+    /**
+     * Sets the time a stage of the receive pipeline was completed. Only called when stage tracing is enabled.
+     */
+    void setStageTime(StageTrace::Stage stage, int64_t time);
+
+    /**
+     * Returns the stage times or "nullptr" when the packet was received while stage tracing was disabled.
+     */
+    StageTrace::StageTimes* getStageTimes() { return _stageTimes.get(); }
 protected:
     static const std::unordered_map<VeluxCommand, VeluxCommand> _requestResponseMapping;
 
@@ -232,6 +271,8 @@ protected:
     int32_t _nodeId = -1;
     VeluxCommand _command = VeluxCommand::UNSET;
     std::vector<uint8_t> _payload;
+    //Only allocated when stage tracing is enabled
+    std::unique_ptr<StageTrace::StageTimes> _stageTimes;
 
     void setNodeId();
 };
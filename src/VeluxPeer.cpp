@@ -60,7 +60,9 @@ VeluxPeer::VeluxPeer(int32_t id, int32_t address, std::string serialNumber, uint
 
 VeluxPeer::~VeluxPeer()
 {
+	flushParameters(true);
 	dispose();
+	if(_destructionCallback) _destructionCallback(_peerID);
 }
 
 std::string VeluxPeer::handleCliCommand(std::string command)
@@ -89,7 +91,9 @@ void VeluxPeer::save(bool savePeer, bool variables, bool centralConfig)
 {
 	try
 	{
-		Peer::save(savePeer, variables, centralConfig);
+		flushParameters(true);
+		//The parameters of a peer which isn't materialized are unchanged and not in memory.
+		Peer::save(savePeer, variables, centralConfig && _materialized);
 	}
 	catch(const std::exception& ex)
     {
@@ -97,6 +101,62 @@ void VeluxPeer::save(bool savePeer, bool variables, bool centralConfig)
     }
 }
 
+size_t VeluxPeer::getDirtyParameterCount()
+{
+	std::lock_guard<std::mutex> dirtyParametersGuard(_dirtyParametersMutex);
+	return _dirtyParameters.size();
+}
+
+void VeluxPeer::saveParameterDeferred(BaseLib::Systems::RpcConfigurationParameter& parameter, uint32_t channel, const std::string& name, std::vector<uint8_t>& data)
+{
+	try
+	{
+		if(_maxParameterStaleness <= 0)
+		{
+			if(parameter.databaseId > 0) saveParameter(parameter.databaseId, data);
+			else saveParameter(0, ParameterGroup::Type::Enum::variables, channel, name, data);
+			return;
+		}
+
+		std::lock_guard<std::mutex> dirtyParametersGuard(_dirtyParametersMutex);
+		if(_dirtyParameters.empty()) _oldestDirtyParameterTime = BaseLib::HelperFunctions::getTime();
+		auto& dirtyParameter = _dirtyParameters[&parameter];
+		dirtyParameter.channel = channel;
+		dirtyParameter.name = name;
+		dirtyParameter.data = data;
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
+void VeluxPeer::flushParameters(bool force)
+{
+	try
+	{
+		std::unordered_map<BaseLib::Systems::RpcConfigurationParameter*, DirtyParameter> dirtyParameters;
+		{
+			std::lock_guard<std::mutex> dirtyParametersGuard(_dirtyParametersMutex);
+			if(_dirtyParameters.empty()) return;
+			if(!force && BaseLib::HelperFunctions::getTime() - _oldestDirtyParameterTime < _maxParameterStaleness) return;
+			dirtyParameters.swap(_dirtyParameters);
+		}
+		if(deleting || _peerID == 0) return;
+
+		for(auto& dirtyParameter : dirtyParameters)
+		{
+			if(dirtyParameter.first->databaseId > 0) saveParameter(dirtyParameter.first->databaseId, dirtyParameter.second.data);
+			else saveParameter(0, ParameterGroup::Type::Enum::variables, dirtyParameter.second.channel, dirtyParameter.second.name, dirtyParameter.second.data);
+		}
+		if(_bl->debugLevel >= 5) GD::out.printDebug("Debug: Peer " + std::to_string(_peerID) + " wrote " + std::to_string(dirtyParameters.size()) + " buffered parameter changes.");
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
 void VeluxPeer::setPhysicalInterfaceId(std::string id)
 {
     if(id.empty() || (GD::physicalInterfaces.find(id) != GD::physicalInterfaces.end() && GD::physicalInterfaces.at(id)))
@@ -165,8 +225,13 @@ bool VeluxPeer::load(BaseLib::Systems::ICentral* central)
 		}
 		initializeTypeString();
 		std::string entry;
-		loadConfig();
-		initializeCentralConfig();
+		if(_lazyLoading) _materialized = false;
+		else
+		{
+			loadConfig();
+			initializeCentralConfig();
+			compilePacketPlans();
+		}
 
 		serviceMessages.reset(new BaseLib::Systems::ServiceMessages(_bl, _peerID, _serialNumber, this));
 		serviceMessages->load();
@@ -180,6 +245,44 @@ bool VeluxPeer::load(BaseLib::Systems::ICentral* central)
     return false;
 }
 
+void VeluxPeer::materialize()
+{
+	try
+	{
+		if(_materialized) return;
+		std::lock_guard<std::mutex> materializeGuard(_materializeMutex);
+		if(_materialized) return;
+		GD::out.printDebug("Debug: Loading parameters of peer " + std::to_string(_peerID) + ".");
+		loadConfig();
+		initializeCentralConfig();
+		compilePacketPlans();
+
+		//"_materialized" is only set once no deferred packets are left, so packets received while the deferred ones are
+		//processed are deferred as well and the order is kept.
+		while(true)
+		{
+			std::vector<PVeluxPacket> pendingPackets;
+			{
+				std::lock_guard<std::mutex> pendingPacketsGuard(_pendingPacketsMutex);
+				if(_pendingPackets.empty())
+				{
+					_materialized = true;
+					break;
+				}
+				pendingPackets.swap(_pendingPackets);
+			}
+			for(auto& pendingPacket : pendingPackets)
+			{
+				processPacket(pendingPacket);
+			}
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+}
+
 void VeluxPeer::saveVariables()
 {
 	try
@@ -236,110 +339,335 @@ bool VeluxPeer::getAllValuesHook2(PRpcClientInfo clientInfo, PParameter paramete
     return false;
 }
 
-void VeluxPeer::getValuesFromPacket(PVeluxPacket packet, std::vector<FrameValues>& frameValues)
+void VeluxPeer::compilePacketPlans()
 {
     try
     {
-        if(!_rpcDevice) return;
-        //equal_range returns all elements with "0" or an unknown element as argument
-        if(_rpcDevice->packetsByMessageType.find((uint32_t)packet->getCommand()) == _rpcDevice->packetsByMessageType.end()) return;
-        std::pair<PacketsByMessageType::iterator, PacketsByMessageType::iterator> range = _rpcDevice->packetsByMessageType.equal_range((uint32_t)packet->getCommand());
-        if(range.first == _rpcDevice->packetsByMessageType.end()) return;
-        PacketsByMessageType::iterator i = range.first;
-        do
+        std::lock_guard<std::mutex> packetPlansGuard(_packetPlansMutex);
+        if(_packetPlansCompiled || !_rpcDevice) return;
+
+        _alwaysEmitParameters.clear();
+        auto setting = GD::family->getFamilySetting("alwaysemitparameters");
+        if(setting)
+        {
+            for(auto& parameterId : BaseLib::HelperFunctions::splitAll(setting->stringValue, ','))
+            {
+                BaseLib::HelperFunctions::trim(parameterId);
+                if(!parameterId.empty()) _alwaysEmitParameters.emplace(parameterId);
+            }
+        }
+
+        _frameDecoders.clear();
+        for(auto& packetIterator : _rpcDevice->packetsByMessageType)
         {
-            FrameValues currentFrameValues;
-            PPacket frame(i->second);
+            PPacket frame = packetIterator.second;
             if(!frame) continue;
-            std::vector<uint8_t> payload = packet->getPayload();
-            if(payload.empty()) break;
-            uint32_t erpPacketBitSize = payload.size() * 8;
-            int32_t channelIndex = frame->channelIndex;
-            int32_t channel = -1;
-            if(channelIndex >= 0 && channelIndex < (signed)payload.size()) channel = payload.at(channelIndex);
-            if(channel > -1 && frame->channelSize < 8.0) channel &= (0xFF >> (8 - std::lround(frame->channelSize)));
-            channel += frame->channelIndexOffset;
-            if(frame->channel > -1) channel = frame->channel;
-            if(channel == -1) continue;
-            currentFrameValues.frameID = frame->id;
-            bool abort = false;
 
-            for(BinaryPayloads::iterator j = frame->binaryPayloads.begin(); j != frame->binaryPayloads.end(); ++j)
+            FrameDecoder decoder;
+            decoder.frame = frame;
+            for(auto& binaryPayload : frame->binaryPayloads)
             {
-                std::vector<uint8_t> data;
-                if((*j)->bitSize > 0 && (*j)->bitIndex > 0)
+                if(binaryPayload->bitSize > 0 && binaryPayload->bitIndex > 0 && binaryPayload->constValueInteger > -1)
                 {
-                    if((*j)->bitIndex >= erpPacketBitSize) continue;
-                    data = packet->getPosition((*j)->bitIndex, (*j)->bitSize);
+                    DecoderCheck check;
+                    check.bitIndex = binaryPayload->bitIndex;
+                    check.bitSize = binaryPayload->bitSize;
+                    check.value = binaryPayload->constValueInteger;
+                    decoder.checks.push_back(check);
+                }
+            }
 
-                    if((*j)->constValueInteger > -1)
-                    {
-                        int32_t intValue = 0;
-                        _bl->hf.memcpyBigEndian(intValue, data);
-                        if(intValue != (*j)->constValueInteger)
-                        {
-                            abort = true;
-                            break;
-                        }
-                        else if((*j)->parameterId.empty()) continue;
-                    }
+            if(frame->channel > -1 || frame->channel == -2) decoder.elements = compileDecoderElements(frame, frame->channel);
+            else
+            {
+                //The channel is read from the payload, so we need one list of elements for every possible channel
+                for(auto& function : _rpcDevice->functions)
+                {
+                    auto elements = compileDecoderElements(frame, function.first);
+                    if(!elements.empty()) decoder.elementsByChannel.emplace(function.first, std::move(elements));
                 }
-                else if((*j)->constValueInteger > -1)
+            }
+            if(decoder.elements.empty() && decoder.elementsByChannel.empty()) continue;
+
+            _frameDecoders[packetIterator.first].push_back(std::move(decoder));
+        }
+
+        _parametersByGroupId.clear();
+        for(auto& channelIterator : valuesCentral)
+        {
+            auto& parametersByGroupId = _parametersByGroupId[channelIterator.first];
+            for(auto& parameterIterator : channelIterator.second)
+            {
+                if(!parameterIterator.second.rpcParameter) continue;
+                //First match wins like in the linear search this replaces.
+                parametersByGroupId.emplace(parameterIterator.second.rpcParameter->physical->groupId, &parameterIterator.second);
+            }
+        }
+
+        _frameEncoders.clear();
+        for(auto& function : _rpcDevice->functions)
+        {
+            PParameterGroup parameterGroup = function.second->getParameterGroup(ParameterGroup::Type::Enum::variables);
+            if(!parameterGroup) continue;
+            for(auto& parameter : parameterGroup->parameters)
+            {
+                if(!parameter.second) continue;
+                for(auto& setPacket : parameter.second->setPackets)
                 {
-                    _bl->hf.memcpyBigEndian(data, (*j)->constValueInteger);
+                    if(_frameEncoders.find(setPacket->id) != _frameEncoders.end()) continue;
+                    auto packetIterator = _rpcDevice->packetsById.find(setPacket->id);
+                    if(packetIterator == _rpcDevice->packetsById.end() || !packetIterator->second) continue;
+                    FrameEncoder encoder = compileFrameEncoder(packetIterator->second);
+                    encoder.channel = function.first;
+                    encoder.parameterId = parameter.first;
+                    _frameEncoders.emplace(setPacket->id, std::move(encoder));
                 }
-                else continue;
+            }
+        }
 
-                for(std::vector<PParameter>::iterator k = frame->associatedVariables.begin(); k != frame->associatedVariables.end(); ++k)
+        _packetPlansCompiled = true;
+    }
+    catch(const std::exception& ex)
+    {
+        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+}
+
+std::vector<VeluxPeer::DecoderElement> VeluxPeer::compileDecoderElements(const PPacket& frame, int32_t channel)
+{
+    std::vector<DecoderElement> elements;
+    try
+    {
+        if(_rpcDevice->functions.empty()) return elements;
+
+        std::list<uint32_t> paramsetChannels;
+        for(auto& binaryPayload : frame->binaryPayloads)
+        {
+            DecoderElement element;
+            if(binaryPayload->bitSize > 0 && binaryPayload->bitIndex > 0)
+            {
+                //Elements with a constant value and without parameter are only checked (see compilePacketPlans()).
+                if(binaryPayload->constValueInteger > -1 && binaryPayload->parameterId.empty()) continue;
+                element.bitIndex = binaryPayload->bitIndex;
+                element.bitSize = binaryPayload->bitSize;
+            }
+            else if(binaryPayload->constValueInteger > -1)
+            {
+                _bl->hf.memcpyBigEndian(element.constValue, binaryPayload->constValueInteger);
+            }
+            else continue;
+
+            for(auto& parameter : frame->associatedVariables)
+            {
+                if(parameter->physical->groupId != binaryPayload->parameterId) continue;
+                ParameterGroup::Type::Enum parameterSetType = parameter->parent()->type();
+                std::vector<uint32_t> channels;
+                if(paramsetChannels.empty()) //Fill paramsetChannels
                 {
-                    if((*k)->physical->groupId != (*j)->parameterId) continue;
-                    currentFrameValues.parameterSetType = (*k)->parent()->type();
-                    bool setValues = false;
-                    if(currentFrameValues.paramsetChannels.empty()) //Fill paramsetChannels
+                    int32_t startChannel = (channel < 0) ? 0 : channel;
+                    int32_t endChannel = startChannel;
+                    //When fixedChannel is -2 (means '*') cycle through all channels
+                    if(frame->channel == -2)
                     {
-                        int32_t startChannel = (channel < 0) ? 0 : channel;
-                        int32_t endChannel;
-                        //When fixedChannel is -2 (means '*') cycle through all channels
-                        if(frame->channel == -2)
-                        {
-                            startChannel = 0;
-                            endChannel = _rpcDevice->functions.rbegin()->first;
-                        }
-                        else endChannel = startChannel;
-                        for(int32_t l = startChannel; l <= endChannel; l++)
-                        {
-                            Functions::iterator functionIterator = _rpcDevice->functions.find(l);
-                            if(functionIterator == _rpcDevice->functions.end()) continue;
-                            PParameterGroup parameterGroup = functionIterator->second->getParameterGroup(currentFrameValues.parameterSetType);
-                            if(!parameterGroup || parameterGroup->parameters.find((*k)->id) == parameterGroup->parameters.end()) continue;
-                            currentFrameValues.paramsetChannels.push_back(l);
-                            currentFrameValues.values[(*k)->id].channels.push_back(l);
-                            setValues = true;
-                        }
+                        startChannel = 0;
+                        endChannel = _rpcDevice->functions.rbegin()->first;
                     }
-                    else //Use paramsetChannels
+                    for(int32_t l = startChannel; l <= endChannel; l++)
                     {
-                        for(std::list<uint32_t>::const_iterator l = currentFrameValues.paramsetChannels.begin(); l != currentFrameValues.paramsetChannels.end(); ++l)
-                        {
-                            Functions::iterator functionIterator = _rpcDevice->functions.find(*l);
-                            if(functionIterator == _rpcDevice->functions.end()) continue;
-                            PParameterGroup parameterGroup = functionIterator->second->getParameterGroup(currentFrameValues.parameterSetType);
-                            if(!parameterGroup || parameterGroup->parameters.find((*k)->id) == parameterGroup->parameters.end()) continue;
-                            currentFrameValues.values[(*k)->id].channels.push_back(*l);
-                            setValues = true;
-                        }
+                        Functions::iterator functionIterator = _rpcDevice->functions.find(l);
+                        if(functionIterator == _rpcDevice->functions.end()) continue;
+                        PParameterGroup parameterGroup = functionIterator->second->getParameterGroup(parameterSetType);
+                        if(!parameterGroup || parameterGroup->parameters.find(parameter->id) == parameterGroup->parameters.end()) continue;
+                        paramsetChannels.push_back(l);
+                        channels.push_back(l);
                     }
-                    if(setValues) currentFrameValues.values[(*k)->id].value = data;
+                }
+                else //Use paramsetChannels
+                {
+                    for(auto paramsetChannel : paramsetChannels)
+                    {
+                        Functions::iterator functionIterator = _rpcDevice->functions.find(paramsetChannel);
+                        if(functionIterator == _rpcDevice->functions.end()) continue;
+                        PParameterGroup parameterGroup = functionIterator->second->getParameterGroup(parameterSetType);
+                        if(!parameterGroup || parameterGroup->parameters.find(parameter->id) == parameterGroup->parameters.end()) continue;
+                        channels.push_back(paramsetChannel);
+                    }
+                }
+
+                for(auto targetChannel : channels)
+                {
+                    auto channelIterator = valuesCentral.find(targetChannel);
+                    if(channelIterator == valuesCentral.end()) continue;
+                    auto parameterIterator = channelIterator->second.find(parameter->id);
+                    if(parameterIterator == channelIterator->second.end() || !parameterIterator->second.rpcParameter)
+                    {
+                        GD::out.printWarning("Warning: Parameter " + parameter->id + " of channel " + std::to_string(targetChannel) + " is not initialized. Peer: " + std::to_string(_peerID) + " Frame: " + frame->id);
+                        continue;
+                    }
+
+                    DecoderTarget target;
+                    target.channel = targetChannel;
+                    target.parameterId = parameter->id;
+                    //Elements of unordered_map are never moved, so the pointer stays valid as long as the element is not erased.
+                    target.parameter = &parameterIterator->second;
+                    target.alwaysEmit = _alwaysEmitParameters.find(parameter->id) != _alwaysEmitParameters.end();
+                    element.targets.push_back(std::move(target));
+                }
+            }
+
+            if(!element.targets.empty()) elements.push_back(std::move(element));
+        }
+    }
+    catch(const std::exception& ex)
+    {
+        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+    return elements;
+}
+
+void VeluxPeer::decodePacket(const PVeluxPacket& packet, std::vector<DecodedValue>& decodedValues)
+{
+    try
+    {
+        auto decodersIterator = _frameDecoders.find((uint32_t)packet->getCommand());
+        if(decodersIterator == _frameDecoders.end()) return;
+        const std::vector<uint8_t>& payload = packet->getPayload();
+        if(payload.empty()) return;
+        int32_t payloadBitSize = payload.size() * 8;
+
+        for(auto& decoder : decodersIterator->second)
+        {
+            const PPacket& frame = decoder.frame;
+            int32_t channel = -1;
+            if(frame->channelIndex >= 0 && frame->channelIndex < (signed)payload.size()) channel = payload[frame->channelIndex];
+            if(channel > -1 && frame->channelSize < 8.0) channel &= (0xFF >> (8 - std::lround(frame->channelSize)));
+            channel += frame->channelIndexOffset;
+            if(frame->channel > -1) channel = frame->channel;
+            if(channel == -1) continue;
+
+            bool abort = false;
+            for(auto& check : decoder.checks)
+            {
+                if(check.bitIndex >= payloadBitSize) continue;
+                if(packet->getPositionInteger(check.bitIndex, check.bitSize) != check.value)
+                {
+                    abort = true;
+                    break;
                 }
             }
             if(abort) continue;
-            if(!currentFrameValues.values.empty()) frameValues.push_back(currentFrameValues);
-        } while(++i != range.second && i != _rpcDevice->packetsByMessageType.end());
+
+            const std::vector<DecoderElement>* elements = &decoder.elements;
+            if(frame->channel == -1)
+            {
+                auto elementsIterator = decoder.elementsByChannel.find(channel);
+                if(elementsIterator == decoder.elementsByChannel.end()) continue;
+                elements = &elementsIterator->second;
+            }
+
+            for(auto& element : *elements)
+            {
+                if(element.bitSize > 0 && element.bitIndex >= payloadBitSize) continue;
+                std::vector<uint8_t> value = element.bitSize > 0 ? packet->getPosition(element.bitIndex, element.bitSize) : element.constValue;
+                for(auto& target : element.targets)
+                {
+                    DecodedValue decodedValue;
+                    decodedValue.target = &target;
+                    decodedValue.value = value;
+                    decodedValues.push_back(std::move(decodedValue));
+                }
+            }
+        }
+    }
+    catch(const std::exception& ex)
+    {
+        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+}
+
+VeluxPeer::FrameEncoder VeluxPeer::compileFrameEncoder(const PPacket& frame)
+{
+    FrameEncoder encoder;
+    try
+    {
+        encoder.frame = frame;
+        VeluxPacket packet((VeluxCommand)frame->type, std::vector<uint8_t>());
+        for(auto& binaryPayload : frame->binaryPayloads)
+        {
+            if(binaryPayload->parameterId != "SESSION_ID" && binaryPayload->parameterId != "NODE_ID" && binaryPayload->constValueInteger > -1)
+            {
+                packet.setPosition(binaryPayload->bitIndex, binaryPayload->bitSize, (uint32_t)binaryPayload->constValueInteger);
+                continue;
+            }
+
+            EncoderSlot slot;
+            if(binaryPayload->parameterId == "SESSION_ID") slot.type = EncoderSlot::Type::sessionId;
+            else if(binaryPayload->parameterId == "NODE_ID") slot.type = EncoderSlot::Type::nodeId;
+            slot.bitIndex = binaryPayload->bitIndex;
+            slot.bitSize = binaryPayload->bitSize;
+            slot.parameterId = binaryPayload->parameterId;
+            slot.parameterChannel = binaryPayload->parameterChannel;
+            encoder.slots.push_back(std::move(slot));
+
+            //Reserve the space of the slot in the template
+            packet.setPosition(binaryPayload->bitIndex, binaryPayload->bitSize, (uint32_t)0);
+        }
+        encoder.payload = packet.getPayload();
     }
     catch(const std::exception& ex)
     {
         GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
     }
+    return encoder;
+}
+
+PVeluxPacket VeluxPeer::encodePacket(const FrameEncoder& encoder, uint32_t channel, const PParameter& rpcParameter, const std::vector<uint8_t>& parameterData)
+{
+    try
+    {
+        auto packet = std::make_shared<VeluxPacket>((VeluxCommand)encoder.frame->type, encoder.payload);
+
+        for(auto& slot : encoder.slots)
+        {
+            if(slot.type == EncoderSlot::Type::sessionId)
+            {
+                packet->setPosition(slot.bitIndex, slot.bitSize, (uint32_t)_physicalInterface->getMessageCounter());
+                continue;
+            }
+            else if(slot.type == EncoderSlot::Type::nodeId)
+            {
+                packet->setPosition(slot.bitIndex, slot.bitSize, (uint32_t)_address);
+                continue;
+            }
+
+            //We can't just search for param, because it is ambiguous (see for example LEVEL for HM-CC-TC.
+            if(slot.parameterId == rpcParameter->physical->groupId)
+            {
+                packet->setPosition(slot.bitIndex, slot.bitSize, parameterData);
+                continue;
+            }
+
+            //Search for all other parameters
+            int32_t currentChannel = slot.parameterChannel;
+            if(currentChannel == -1) currentChannel = channel;
+            BaseLib::Systems::RpcConfigurationParameter* otherParameter = nullptr;
+            auto channelIterator = _parametersByGroupId.find(currentChannel);
+            if(channelIterator != _parametersByGroupId.end())
+            {
+                auto parameterIterator = channelIterator->second.find(slot.parameterId);
+                if(parameterIterator != channelIterator->second.end()) otherParameter = parameterIterator->second;
+            }
+            if(otherParameter) packet->setPosition(slot.bitIndex, slot.bitSize, otherParameter->getBinaryData());
+            else GD::out.printError("Error constructing packet. param \"" + slot.parameterId + "\" not found. Peer: " + std::to_string(_peerID) + " Serial number: " + _serialNumber + " Frame: " + encoder.frame->id);
+        }
+
+        return packet;
+    }
+    catch(const std::exception& ex)
+    {
+        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+    return PVeluxPacket();
 }
 
 void VeluxPeer::packetReceived(std::shared_ptr<VeluxPacket> packet)
@@ -352,73 +680,156 @@ void VeluxPeer::packetReceived(std::shared_ptr<VeluxPacket> packet)
         setLastPacketReceived();
         serviceMessages->endUnreach();
 
-        std::vector<FrameValues> frameValues;
-        getValuesFromPacket(packet, frameValues);
-        std::map<uint32_t, std::shared_ptr<std::vector<std::string>>> valueKeys;
-        std::map<uint32_t, std::shared_ptr<std::vector<PVariable>>> rpcValues;
+        //Loading the parameters involves database I/O, which must not block the reactor thread.
+        if(!_materialized)
+        {
+            std::lock_guard<std::mutex> pendingPacketsGuard(_pendingPacketsMutex);
+            if(!_materialized)
+            {
+                _pendingPackets.push_back(packet);
+                if(_pendingPackets.size() == 1) central->queueMaterialization(_peerID);
+                return;
+            }
+        }
+
+        processPacket(packet);
+    }
+    catch(const std::exception& ex)
+    {
+        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+}
 
-        //Loop through all matching frames
-        for(std::vector<FrameValues>::iterator a = frameValues.begin(); a != frameValues.end(); ++a)
+void VeluxPeer::processPacket(const PVeluxPacket& packet)
+{
+    try
+    {
+        auto central = std::dynamic_pointer_cast<VeluxCentral>(getCentral());
+        if(!central) return;
+        if(!_packetPlansCompiled) compilePacketPlans();
+
+        std::vector<DecodedValue> decodedValues;
+        decodePacket(packet, decodedValues);
+        StageTrace::StageTimes* stageTimes = packet->getStageTimes();
+        if(stageTimes) packet->setStageTime(StageTrace::Stage::decoded, LatencyHistogram::getTime());
+        if(decodedValues.empty())
         {
-            PPacket frame;
-            if(!a->frameID.empty()) frame = _rpcDevice->packetsById.at(a->frameID);
-            if(!frame) continue;
+            if(stageTimes) central->getStageTrace().record(*stageTimes);
+            return;
+        }
 
-            for(std::map<std::string, FrameValue>::iterator i = a->values.begin(); i != a->values.end(); ++i)
-            {
-                for(std::list<uint32_t>::const_iterator j = a->paramsetChannels.begin(); j != a->paramsetChannels.end(); ++j)
-                {
-                    if(std::find(i->second.channels.begin(), i->second.channels.end(), *j) == i->second.channels.end()) continue;
-                    if(!valueKeys[*j] || !rpcValues[*j])
-                    {
-                        valueKeys[*j].reset(new std::vector<std::string>());
-                        rpcValues[*j].reset(new std::vector<PVariable>());
-                    }
+        bool movementFinished = false;
+        bool throttlePosition = throttlePositionEvents(packet, movementFinished);
 
-                    BaseLib::Systems::RpcConfigurationParameter& parameter = valuesCentral[*j][i->first];
-                    parameter.setBinaryData(i->second.value);
-                    if(parameter.databaseId > 0) saveParameter(parameter.databaseId, i->second.value);
-                    else saveParameter(0, ParameterGroup::Type::Enum::variables, *j, i->first, i->second.value);
-                    if(_bl->debugLevel >= 4) GD::out.printInfo("Info: " + i->first + " on channel " + std::to_string(*j) + " of peer " + std::to_string(_peerID) + " with serial number " + _serialNumber  + " was set to 0x" + BaseLib::HelperFunctions::getHexString(i->second.value) + ".");
+        std::vector<uint32_t> eventChannels;
+        std::vector<std::shared_ptr<std::vector<std::string>>> valueKeys;
+        std::vector<std::shared_ptr<std::vector<PVariable>>> rpcValues;
 
-                    if(parameter.rpcParameter)
-                    {
-                        //Process service messages
-                        if(parameter.rpcParameter->service && !i->second.value.empty())
-                        {
-                            if(parameter.rpcParameter->logical->type == ILogical::Type::Enum::tEnum)
-                            {
-                                serviceMessages->set(i->first, i->second.value.at(0), *j);
-                            }
-                            else if(parameter.rpcParameter->logical->type == ILogical::Type::Enum::tBoolean)
-                            {
-                                serviceMessages->set(i->first, parameter.rpcParameter->convertFromPacket(i->second.value, parameter.mainRole(), true)->booleanValue);
-                            }
-                        }
+        for(auto& decodedValue : decodedValues)
+        {
+            const DecoderTarget& target = *decodedValue.target;
+            BaseLib::Systems::RpcConfigurationParameter& parameter = *target.parameter;
+            bool isPosition = target.parameterId == "CURRENT_POSITION";
+            //Make sure the final position reaches the clients even if it already was stored by a throttled packet.
+            bool forceEmit = movementFinished && isPosition && _suppressedPositionParameters.erase(target.parameter) > 0;
+            //Unchanged values are neither written to the database nor sent to clients.
+            if(!target.alwaysEmit && !forceEmit && parameter.equals(decodedValue.value)) continue;
+            parameter.setBinaryData(decodedValue.value);
+            saveParameterDeferred(parameter, target.channel, target.parameterId, decodedValue.value);
+            if(_bl->debugLevel >= 4) GD::out.printInfo("Info: " + target.parameterId + " on channel " + std::to_string(target.channel) + " of peer " + std::to_string(_peerID) + " with serial number " + _serialNumber  + " was set to 0x" + BaseLib::HelperFunctions::getHexString(decodedValue.value) + ".");
 
-                        valueKeys[*j]->push_back(i->first);
-                        rpcValues[*j]->push_back(parameter.rpcParameter->convertFromPacket(i->second.value, parameter.mainRole(), true));
-                    }
+            if(!parameter.rpcParameter) continue;
+
+            //Process service messages
+            if(parameter.rpcParameter->service && !decodedValue.value.empty())
+            {
+                if(parameter.rpcParameter->logical->type == ILogical::Type::Enum::tEnum)
+                {
+                    serviceMessages->set(target.parameterId, decodedValue.value.at(0), target.channel);
+                }
+                else if(parameter.rpcParameter->logical->type == ILogical::Type::Enum::tBoolean)
+                {
+                    serviceMessages->set(target.parameterId, parameter.rpcParameter->convertFromPacket(decodedValue.value, parameter.mainRole(), true)->booleanValue);
                 }
             }
-        }
 
-        if(!rpcValues.empty())
-        {
-            for(std::map<uint32_t, std::shared_ptr<std::vector<std::string>>>::iterator j = valueKeys.begin(); j != valueKeys.end(); ++j)
+            if(isPosition)
             {
-                if(j->second->empty()) continue;
-                std::string eventSource = "device-" + std::to_string(_peerID);
-                std::string address(_serialNumber + ":" + std::to_string(j->first));
-                raiseEvent(eventSource, _peerID, j->first, j->second, rpcValues.at(j->first));
-                raiseRPCEvent(eventSource, _peerID, j->first, address, j->second, rpcValues.at(j->first));
+                if(throttlePosition)
+                {
+                    _suppressedPositionParameters.insert(target.parameter);
+                    continue;
+                }
+                _suppressedPositionParameters.erase(target.parameter);
             }
+
+            size_t index = 0;
+            while(index < eventChannels.size() && eventChannels[index] != target.channel) index++;
+            if(index == eventChannels.size())
+            {
+                eventChannels.push_back(target.channel);
+                valueKeys.push_back(std::make_shared<std::vector<std::string>>());
+                rpcValues.push_back(std::make_shared<std::vector<PVariable>>());
+            }
+            valueKeys[index]->push_back(target.parameterId);
+            rpcValues[index]->push_back(parameter.rpcParameter->convertFromPacket(decodedValue.value, parameter.mainRole(), true));
+        }
+        if(stageTimes) packet->setStageTime(StageTrace::Stage::saved, LatencyHistogram::getTime());
+
+        for(size_t i = 0; i < eventChannels.size(); i++)
+        {
+            std::string eventSource = "device-" + std::to_string(_peerID);
+            std::string address(_serialNumber + ":" + std::to_string(eventChannels[i]));
+            raiseEvent(eventSource, _peerID, eventChannels[i], valueKeys[i], rpcValues[i]);
+            raiseRPCEvent(eventSource, _peerID, eventChannels[i], address, valueKeys[i], rpcValues[i]);
+            central->countRaisedEvents(valueKeys[i]->size());
+        }
+
+        if(stageTimes)
+        {
+            if(!eventChannels.empty()) packet->setStageTime(StageTrace::Stage::eventRaised, LatencyHistogram::getTime());
+            central->getStageTrace().record(*stageTimes);
+        }
+    }
+    catch(const std::exception& ex)
+    {
+        GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+}
+
+bool VeluxPeer::throttlePositionEvents(const PVeluxPacket& packet, bool& movementFinished)
+{
+    movementFinished = false;
+    try
+    {
+        if(packet->getCommand() != VeluxCommand::GW_NODE_STATE_POSITION_CHANGED_NTF || !_physicalInterface) return false;
+        const std::vector<uint8_t>& payload = packet->getPayload();
+        int32_t interval = _physicalInterface->getEventThrottleInterval();
+        if(payload.size() < 2 || interval <= 0) return false;
+
+        //State 4 is "executing". Everything else ends the movement.
+        if(payload[1] != 4)
+        {
+            movementFinished = true;
+            _positionMoving = false;
+            return false;
+        }
+
+        int64_t time = BaseLib::HelperFunctions::getTime();
+        if(!_positionMoving || time - _lastPositionEvent >= interval)
+        {
+            _positionMoving = true;
+            _lastPositionEvent = time;
+            return false;
         }
+
+        return true;
     }
     catch(const std::exception& ex)
     {
         GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
     }
+    return false;
 }
 
 std::string VeluxPeer::getFirmwareVersionString(int32_t firmwareVersion)
@@ -463,6 +874,8 @@ PVariable VeluxPeer::getParamsetDescription(BaseLib::PRpcClientInfo clientInfo,
 		if(functionIterator == _rpcDevice->functions.end()) return Variable::createError(-2, "Unknown channel");
 		PParameterGroup parameterGroup = functionIterator->second->getParameterGroup(type);
 		if(!parameterGroup) return Variable::createError(-3, "Unknown parameter set");
+		//The description contains the roles of the variables, which are stored in "valuesCentral".
+		materialize();
 
 		return Peer::getParamsetDescription(clientInfo, channel, parameterGroup, checkAcls);
 	}
@@ -519,6 +932,7 @@ PVariable VeluxPeer::getParamset(BaseLib::PRpcClientInfo clientInfo, int32_t cha
 		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
 		if(channel < 0) channel = 0;
 		if(remoteChannel < 0) remoteChannel = 0;
+		materialize();
 		Functions::iterator functionIterator = _rpcDevice->functions.find(channel);
 		if(functionIterator == _rpcDevice->functions.end()) return Variable::createError(-2, "Unknown channel");
 		PParameterGroup parameterGroup = functionIterator->second->getParameterGroup(type);
@@ -561,12 +975,138 @@ PVariable VeluxPeer::getParamset(BaseLib::PRpcClientInfo clientInfo, int32_t cha
     return Variable::createError(-32500, "Unknown application error.");
 }
 
+PVariable VeluxPeer::getValue(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string valueKey, bool requestFromDevice, bool asynchronous)
+{
+	try
+	{
+		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
+		materialize();
+		return Peer::getValue(clientInfo, channel, valueKey, requestFromDevice, asynchronous);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxPeer::getAllValues(BaseLib::PRpcClientInfo clientInfo, bool returnWriteOnly, bool checkAcls)
+{
+	try
+	{
+		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
+		materialize();
+		return Peer::getAllValues(clientInfo, returnWriteOnly, checkAcls);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxPeer::getAllConfig(BaseLib::PRpcClientInfo clientInfo)
+{
+	try
+	{
+		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
+		materialize();
+		return Peer::getAllConfig(clientInfo);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxPeer::getConfigParameter(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string name)
+{
+	try
+	{
+		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
+		materialize();
+		return Peer::getConfigParameter(clientInfo, channel, name);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxPeer::getVariableDescription(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string valueKey, const std::unordered_set<std::string>& fields)
+{
+	try
+	{
+		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
+		materialize();
+		return Peer::getVariableDescription(clientInfo, channel, valueKey, fields);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxPeer::getVariablesInCategory(BaseLib::PRpcClientInfo clientInfo, uint64_t categoryId, bool checkAcls)
+{
+	try
+	{
+		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
+		materialize();
+		return Peer::getVariablesInCategory(clientInfo, categoryId, checkAcls);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxPeer::getVariablesInRole(BaseLib::PRpcClientInfo clientInfo, uint64_t roleId, bool checkAcls)
+{
+	try
+	{
+		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
+		materialize();
+		return Peer::getVariablesInRole(clientInfo, roleId, checkAcls);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
+PVariable VeluxPeer::getVariablesInRoom(BaseLib::PRpcClientInfo clientInfo, uint64_t roomId, bool checkAcls)
+{
+	try
+	{
+		if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
+		materialize();
+		return Peer::getVariablesInRoom(clientInfo, roomId, checkAcls);
+	}
+	catch(const std::exception& ex)
+	{
+		GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+	}
+	return Variable::createError(-32500, "Unknown application error.");
+}
+
 PVariable VeluxPeer::setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string valueKey, PVariable value, bool wait)
+{
+    return setValue(clientInfo, channel, valueKey, value, wait, nullptr);
+}
+
+PVariable VeluxPeer::setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string valueKey, PVariable value, bool wait, std::vector<PVeluxPacket>* packets)
 {
     try
     {
         if(_disposing) return Variable::createError(-32500, "Peer is disposing.");
         if(!value) return Variable::createError(-32500, "value is nullptr.");
+        materialize();
         Peer::setValue(clientInfo, channel, valueKey, value, wait); //Ignore result, otherwise setHomegerValue might not be executed
         std::shared_ptr<VeluxCentral> central = std::dynamic_pointer_cast<VeluxCentral>(getCentral());
         if(!central) return Variable::createError(-32500, "Could not get central object.");;
@@ -587,8 +1127,7 @@ PVariable VeluxPeer::setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t chann
             std::vector<uint8_t> parameterData;
             rpcParameter->convertToPacket(value, parameter.mainRole(), parameterData);
             parameter.setBinaryData(parameterData);
-            if(parameter.databaseId > 0) saveParameter(parameter.databaseId, parameterData);
-            else saveParameter(0, ParameterGroup::Type::Enum::variables, channel, valueKey, parameterData);
+            saveParameterDeferred(parameter, channel, valueKey, parameterData);
 
             if(rpcParameter->readable)
             {
@@ -624,8 +1163,7 @@ PVariable VeluxPeer::setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t chann
         std::vector<uint8_t> parameterData;
         rpcParameter->convertToPacket(value, parameter.mainRole(), parameterData);
         parameter.setBinaryData(parameterData);
-        if(parameter.databaseId > 0) saveParameter(parameter.databaseId, parameterData);
-        else saveParameter(0, ParameterGroup::Type::Enum::variables, channel, valueKey, parameterData);
+        saveParameterDeferred(parameter, channel, valueKey, parameterData);
         if(_bl->debugLevel >= 4) GD::out.printInfo("Info: " + valueKey + " of peer " + std::to_string(_peerID) + " with serial number " + _serialNumber + ":" + std::to_string(channel) + " was set to 0x" + BaseLib::HelperFunctions::getHexString(parameterData) + ".");
 
         if(rpcParameter->readable)
@@ -634,65 +1172,15 @@ PVariable VeluxPeer::setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t chann
             values->push_back(rpcParameter->convertFromPacket(parameterData, parameter.mainRole(), true));
         }
 
+        if(!_packetPlansCompiled) compilePacketPlans();
         for(std::shared_ptr<Parameter::Packet> setRequest : setRequests)
         {
-            PacketsById::iterator packetIterator = _rpcDevice->packetsById.find(setRequest->id);
-            if(packetIterator == _rpcDevice->packetsById.end()) return Variable::createError(-6, "No frame was found for parameter " + valueKey);
-            PPacket frame = packetIterator->second;
-
-            auto packet = std::make_shared<VeluxPacket>((VeluxCommand)frame->type, std::vector<uint8_t>());
-
-            for(BinaryPayloads::iterator i = frame->binaryPayloads.begin(); i != frame->binaryPayloads.end(); ++i)
-            {
-                if((*i)->parameterId == "SESSION_ID")
-                {
-                    int32_t messageCounter = _physicalInterface->getMessageCounter();
-                    std::vector<uint8_t> data;
-                    _bl->hf.memcpyBigEndian(data, messageCounter);
-                    packet->setPosition((*i)->bitIndex, (*i)->bitSize, data);
-                    continue;
-                }
-                else if((*i)->parameterId == "NODE_ID")
-                {
-                    std::vector<uint8_t> data;
-                    _bl->hf.memcpyBigEndian(data, (int32_t)_address);
-                    packet->setPosition((*i)->bitIndex, (*i)->bitSize, data);
-                    continue;
-                }
+            auto encoderIterator = _frameEncoders.find(setRequest->id);
+            if(encoderIterator == _frameEncoders.end()) return Variable::createError(-6, "No frame was found for parameter " + valueKey);
+            PPacket frame = encoderIterator->second.frame;
 
-                if((*i)->constValueInteger > -1)
-                {
-                    std::vector<uint8_t> data;
-                    _bl->hf.memcpyBigEndian(data, (*i)->constValueInteger);
-                    packet->setPosition((*i)->bitIndex, (*i)->bitSize, data);
-                    continue;
-                }
-                //We can't just search for param, because it is ambiguous (see for example LEVEL for HM-CC-TC.
-                if((*i)->parameterId == rpcParameter->physical->groupId)
-                {
-                    std::vector<uint8_t> data = valuesCentral[channel][valueKey].getBinaryData();
-                    packet->setPosition((*i)->bitIndex, (*i)->bitSize, data);
-                }
-                    //Search for all other parameters
-                else
-                {
-                    bool paramFound = false;
-                    int32_t currentChannel = (*i)->parameterChannel;
-                    if(currentChannel == -1) currentChannel = channel;
-                    for(std::unordered_map<std::string, BaseLib::Systems::RpcConfigurationParameter>::iterator j = valuesCentral[currentChannel].begin(); j != valuesCentral[currentChannel].end(); ++j)
-                    {
-                        //Only compare id. Till now looking for value_id was not necessary.
-                        if((*i)->parameterId == j->second.rpcParameter->physical->groupId)
-                        {
-                            std::vector<uint8_t> data = j->second.getBinaryData();
-                            packet->setPosition((*i)->bitIndex, (*i)->bitSize, data);
-                            paramFound = true;
-                            break;
-                        }
-                    }
-                    if(!paramFound) GD::out.printError("Error constructing packet. param \"" + (*i)->parameterId + "\" not found. Peer: " + std::to_string(_peerID) + " Serial number: " + _serialNumber + " Frame: " + frame->id);
-                }
-            }
+            auto packet = encodePacket(encoderIterator->second, channel, rpcParameter, parameterData);
+            if(!packet) return Variable::createError(-32500, "Could not construct packet for parameter " + valueKey);
 
             if(!setRequest->autoReset.empty())
             {
@@ -706,8 +1194,7 @@ PVariable VeluxPeer::setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t chann
                     if(!resetParameterIterator->second.equals(defaultValue))
                     {
                         resetParameterIterator->second.setBinaryData(defaultValue);
-                        if(resetParameterIterator->second.databaseId > 0) saveParameter(resetParameterIterator->second.databaseId, defaultValue);
-                        else saveParameter(0, ParameterGroup::Type::Enum::variables, channel, *j, defaultValue);
+                        saveParameterDeferred(resetParameterIterator->second, channel, *j, defaultValue);
                         GD::out.printInfo( "Info: Parameter \"" + *j + "\" was reset to " + BaseLib::HelperFunctions::getHexString(defaultValue) + ". Peer: " + std::to_string(_peerID) + " Serial number: " + _serialNumber + " Frame: " + frame->id);
                         if(rpcParameter->readable)
                         {
@@ -718,7 +1205,8 @@ PVariable VeluxPeer::setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t chann
                 }
             }
 
-            _physicalInterface->sendPacket(packet);
+            if(packets) packets->push_back(packet);
+            else _physicalInterface->sendPacket(packet);
         }
 
         if(!valueKeys->empty())
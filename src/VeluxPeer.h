@@ -36,7 +36,11 @@
 
 #include <homegear-base/BaseLib.h>
 
+#include <atomic>
+#include <functional>
 #include <list>
+#include <mutex>
+#include <unordered_set>
 
 using namespace BaseLib;
 using namespace BaseLib::DeviceDescription;
@@ -65,6 +69,11 @@ public:
 
 	std::shared_ptr<Klf200>& getPhysicalInterface() { return _physicalInterface; }
 
+	/**
+	 * Scenes of the KLF200 are virtual peers. Their address is the scene ID, so they are not in the node tables.
+	 */
+	bool isScene() { return _deviceType == 0x80000000; }
+
 	virtual std::string handleCliCommand(std::string command);
 
 	virtual bool load(BaseLib::Systems::ICentral* central);
@@ -77,6 +86,48 @@ public:
 
 	void packetReceived(std::shared_ptr<VeluxPacket> packet);
 
+	/**
+	 * Sets the time in milliseconds a changed parameter may stay in memory before it is written to the database. "0"
+	 * writes every change immediately.
+	 */
+	void setMaxParameterStaleness(int64_t value) { _maxParameterStaleness = value; }
+
+	/**
+	 * When set to "true" before calling load(), only the identity of the peer is loaded. The parameters are loaded by
+	 * materialize() when they are needed for the first time.
+	 */
+	void setLazyLoading(bool value) { _lazyLoading = value; }
+
+	/**
+	 * Returns "false" when the peer was loaded lazily and its parameters are not loaded yet.
+	 */
+	bool isMaterialized() { return _materialized; }
+
+	/**
+	 * Loads the parameters of a lazily loaded peer and compiles the packet plans. Does nothing when this was done
+	 * already. Packets received in the meantime were deferred by packetReceived() and are processed here before the
+	 * peer is marked as materialized.
+	 */
+	void materialize();
+
+	/**
+	 * Sets a function the destructor calls with the peer ID. Used by VeluxCentral::deletePeer() to delete the peer from
+	 * the database once nothing references it anymore.
+	 */
+	void setDestructionCallback(std::function<void(uint64_t)> value) { _destructionCallback = std::move(value); }
+
+	/**
+	 * Writes buffered parameter changes to the database.
+	 *
+	 * @param force When "false", the buffer is only written if the oldest change is older than the maximum staleness.
+	 */
+	void flushParameters(bool force);
+
+	/**
+	 * Returns the number of parameter changes not written to the database yet.
+	 */
+	size_t getDirtyParameterCount();
+
 	//RPC methods
 	/**
 	 * {@inheritDoc}
@@ -98,24 +149,137 @@ public:
 	 */
 	virtual PVariable putParamset(BaseLib::PRpcClientInfo clientInfo, int32_t channel, ParameterGroup::Type::Enum type, uint64_t remoteID, int32_t remoteChannel, PVariable variables, bool checkAcls, bool onlyPushing = false);
 
+	/**
+	 * {@inheritDoc}
+	 */
+	virtual PVariable getValue(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string valueKey, bool requestFromDevice, bool asynchronous);
+
+	/**
+	 * {@inheritDoc}
+	 */
+	virtual PVariable getAllValues(BaseLib::PRpcClientInfo clientInfo, bool returnWriteOnly, bool checkAcls);
+
+	/**
+	 * {@inheritDoc}
+	 */
+	virtual PVariable getAllConfig(BaseLib::PRpcClientInfo clientInfo);
+
+	/**
+	 * {@inheritDoc}
+	 */
+	virtual PVariable getConfigParameter(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string name);
+
+	/**
+	 * {@inheritDoc}
+	 */
+	virtual PVariable getVariableDescription(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string valueKey, const std::unordered_set<std::string>& fields);
+
+	/**
+	 * {@inheritDoc}
+	 */
+	virtual PVariable getVariablesInCategory(BaseLib::PRpcClientInfo clientInfo, uint64_t categoryId, bool checkAcls);
+
+	/**
+	 * {@inheritDoc}
+	 */
+	virtual PVariable getVariablesInRole(BaseLib::PRpcClientInfo clientInfo, uint64_t roleId, bool checkAcls);
+
+	/**
+	 * {@inheritDoc}
+	 */
+	virtual PVariable getVariablesInRoom(BaseLib::PRpcClientInfo clientInfo, uint64_t roomId, bool checkAcls);
+
 	/**
 	 * {@inheritDoc}
 	 */
 	virtual PVariable setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string valueKey, PVariable value, bool wait);
+
+	/**
+	 * Same as setValue(), but when "packets" is set, the frames are added to it instead of being sent. This is used by
+	 * VeluxCentral::setValues() to combine the frames of several peers.
+	 */
+	PVariable setValue(BaseLib::PRpcClientInfo clientInfo, uint32_t channel, std::string valueKey, PVariable value, bool wait, std::vector<PVeluxPacket>* packets);
 	//End RPC methods
 protected:
-    struct FrameValue
+    struct DecoderCheck
+    {
+        int32_t bitIndex = 0;
+        int32_t bitSize = 0;
+        int32_t value = 0;
+    };
+
+    struct DecoderTarget
+    {
+        uint32_t channel = 0;
+        std::string parameterId;
+        BaseLib::Systems::RpcConfigurationParameter* parameter = nullptr;
+        //Raise events even if the value didn't change (family setting "alwaysEmitParameters").
+        bool alwaysEmit = false;
+    };
+
+    struct DecoderElement
+    {
+        int32_t bitIndex = 0;
+        int32_t bitSize = 0;
+        std::vector<uint8_t> constValue;
+        std::vector<DecoderTarget> targets;
+    };
+
+    /**
+     * Decoder plan of one frame definition. It is compiled from the device description once and contains everything
+     * needed to decode a received packet without looking up the device description again.
+     */
+    struct FrameDecoder
+    {
+        PPacket frame;
+        std::vector<DecoderCheck> checks;
+        //Used when the channel is fixed by the frame definition.
+        std::vector<DecoderElement> elements;
+        //Used when the channel is read from the payload. The key is the channel.
+        std::map<int32_t, std::vector<DecoderElement>> elementsByChannel;
+    };
+
+    struct DecodedValue
     {
-        std::list<uint32_t> channels;
+        const DecoderTarget* target = nullptr;
         std::vector<uint8_t> value;
     };
 
-    struct FrameValues
+    struct DirtyParameter
     {
-        std::string frameID;
-        std::list<uint32_t> paramsetChannels;
-        ParameterGroup::Type::Enum parameterSetType;
-        std::map<std::string, FrameValue> values;
+        uint32_t channel = 0;
+        std::string name;
+        std::vector<uint8_t> data;
+    };
+
+    struct EncoderSlot
+    {
+        enum class Type
+        {
+            sessionId,
+            nodeId,
+            parameter
+        };
+
+        Type type = Type::parameter;
+        int32_t bitIndex = 0;
+        int32_t bitSize = 0;
+        std::string parameterId;
+        int32_t parameterChannel = -1;
+    };
+
+    /**
+     * Encoder template of one frame definition. "payload" already contains all constant values, so to build a packet
+     * only the slots need to be filled in.
+     */
+    struct FrameEncoder
+    {
+        PPacket frame;
+        std::vector<uint8_t> payload;
+        std::vector<EncoderSlot> slots;
+        //The first parameter using this frame. Only used for benchmarking.
+        uint32_t channel = 0;
+        std::string parameterId;
     };
 
 	//In table variables:
@@ -124,11 +288,75 @@ protected:
 
 	std::shared_ptr<Klf200> _physicalInterface;
 
+	std::function<void(uint64_t)> _destructionCallback;
+
+	//{{{ Lazy loading
+	bool _lazyLoading = false;
+	std::mutex _materializeMutex;
+	std::atomic_bool _materialized{true};
+	//Packets received before the parameters were loaded. Loading them involves database I/O, which must not happen on
+	//the reactor thread, so the central's worker thread materializes the peer and processes these packets afterwards.
+	std::mutex _pendingPacketsMutex;
+	std::vector<PVeluxPacket> _pendingPackets;
+	//}}}
+
+	std::mutex _packetPlansMutex;
+	std::atomic_bool _packetPlansCompiled{false};
+	std::unordered_map<uint32_t, std::vector<FrameDecoder>> _frameDecoders;
+	std::unordered_set<std::string> _alwaysEmitParameters;
+	std::unordered_map<std::string, FrameEncoder> _frameEncoders;
+	//Index of "valuesCentral" by channel and physical group ID. Elements of "valuesCentral" are never erased after
+	//loading, so the pointers stay valid.
+	std::unordered_map<uint32_t, std::unordered_map<std::string, BaseLib::Systems::RpcConfigurationParameter*>> _parametersByGroupId;
+
+	//{{{ Position event throttling
+	bool _positionMoving = false;
+	int64_t _lastPositionEvent = 0;
+	//CURRENT_POSITION parameters whose last change wasn't sent to clients
+	std::unordered_set<BaseLib::Systems::RpcConfigurationParameter*> _suppressedPositionParameters;
+	//}}}
+
+	std::atomic<int64_t> _maxParameterStaleness{0};
+	std::mutex _dirtyParametersMutex;
+	std::unordered_map<BaseLib::Systems::RpcConfigurationParameter*, DirtyParameter> _dirtyParameters;
+	int64_t _oldestDirtyParameterTime = 0;
+
 	virtual void setPhysicalInterface(std::shared_ptr<Klf200> interface);
 
+	/**
+	 * Saves a changed variable either immediately or, when a maximum staleness is set, buffers it until the next
+	 * call to flushParameters(). Only the latest value per parameter is kept.
+	 */
+	void saveParameterDeferred(BaseLib::Systems::RpcConfigurationParameter& parameter, uint32_t channel, const std::string& name, std::vector<uint8_t>& data);
+
 	virtual std::shared_ptr<BaseLib::Systems::ICentral> getCentral();
 
-    void getValuesFromPacket(PVeluxPacket packet, std::vector<FrameValues>& frameValue);
+    /**
+     * Compiles the decoder and encoder plans for all frames of the device description and the parameter index. Needs to
+     * be called after "valuesCentral" is filled, because the plans point directly to the elements of "valuesCentral".
+     */
+    void compilePacketPlans();
+    std::vector<DecoderElement> compileDecoderElements(const PPacket& frame, int32_t channel);
+    void decodePacket(const PVeluxPacket& packet, std::vector<DecodedValue>& decodedValues);
+
+    /**
+     * Decodes a received packet and raises the events. Called by packetReceived() and by materialize() for deferred
+     * packets.
+     */
+    void processPacket(const PVeluxPacket& packet);
+
+    /**
+     * Limits the CURRENT_POSITION events of position notifications while the node is moving to one per
+     * "eventThrottleInterval". The first and the final notification of a movement are never throttled.
+     *
+     * @param packet The received packet.
+     * @param[out] movementFinished Set to "true" when the packet ends a movement. Suppressed positions then need to be
+     * sent even if they didn't change.
+     * @return Returns "true" when no CURRENT_POSITION events should be raised for the packet.
+     */
+    bool throttlePositionEvents(const PVeluxPacket& packet, bool& movementFinished);
+    FrameEncoder compileFrameEncoder(const PPacket& frame);
+    PVeluxPacket encodePacket(const FrameEncoder& encoder, uint32_t channel, const PParameter& rpcParameter, const std::vector<uint8_t>& parameterData);
 
 	virtual PParameterGroup getParameterSet(int32_t channel, ParameterGroup::Type::Enum type);
 